@@ -0,0 +1,136 @@
+#ifndef __ARENA_HPP__
+#define __ARENA_HPP__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+// ends the compilation, in lexer_util.cpp
+[[noreturn]] void error_exit();
+
+/*
+* A bump allocator for everything the parser builds: the nodes of the
+* AST, their vectors and their string literals. Nothing in it is freed
+* on its own, and no destructor runs; release() gives back all of it at
+* once when the compilation of a file is over. It keeps its first chunk
+* for the next file, so a batch of small files allocates it only once.
+* A mark() taken before a function is parsed lets reset() give back
+* the function alone, once it has been compiled.
+*/
+class Arena {
+public:
+  Arena() : next(0), limit(0), first_size(0) {}
+  ~Arena()
+  {
+    for (char *chunk : chunks)
+      std::free(chunk);
+  }
+
+  void *allocate(size_t size, size_t align = alignof(std::max_align_t))
+  {
+    uintptr_t p = (next + align - 1) & ~(uintptr_t)(align - 1);
+    if (next == 0 || p + size > limit) {
+      grow(size + align);
+      p = (next + align - 1) & ~(uintptr_t)(align - 1);
+    }
+    next = p + size;
+    return (void *)p;
+  }
+
+  template <class T, class... Args>
+  T *make(Args &&...args)
+  {
+    return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  // where the arena is at, to go back to with reset()
+  struct Mark {
+    size_t chunks;
+    uintptr_t next;
+    uintptr_t limit;
+  };
+
+  Mark mark() const { return { chunks.size(), next, limit }; }
+
+  // frees everything allocated since the mark
+  void reset(const Mark &m)
+  {
+    for (size_t i = m.chunks; i < chunks.size(); i++)
+      std::free(chunks[i]);
+    chunks.resize(m.chunks);
+    next = m.next;
+    limit = m.limit;
+  }
+
+  void release()
+  {
+    if (chunks.empty())
+      return;
+    for (size_t i = 1; i < chunks.size(); i++)
+      std::free(chunks[i]);
+    chunks.resize(1);
+    next = (uintptr_t)chunks[0];
+    limit = next + first_size;
+  }
+
+private:
+  static const size_t first_chunk_size = 64 * 1024;
+  static const size_t largest_chunk_size = 4 * 1024 * 1024;
+
+  std::vector<char *> chunks;
+  uintptr_t next;
+  uintptr_t limit;
+  size_t first_size;
+
+  // the chunks double in size, so a large program needs only a few of them
+  void grow(size_t at_least)
+  {
+    size_t size = chunks.size() < 6 ? first_chunk_size << chunks.size() : largest_chunk_size;
+    size = std::max(size, at_least);
+    char *chunk = (char *)std::malloc(size);
+    // llvm is built without exceptions, and so is the compiler
+    if (chunk == nullptr) {
+      std::fputs("Out of memory\n", stderr);
+      error_exit();
+    }
+    if (chunks.empty())
+      first_size = size;
+    chunks.push_back(chunk);
+    next = (uintptr_t)chunk;
+    limit = next + size;
+  }
+};
+
+// Every thread compiles into its own arena
+extern thread_local Arena ast_arena;
+
+// An allocator for the containers of the AST, which live in the arena with it
+template <class T>
+struct ArenaAllocator {
+  typedef T value_type;
+
+  ArenaAllocator() {}
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U> &) {}
+
+  T *allocate(size_t n) { return (T *)ast_arena.allocate(n * sizeof(T), alignof(T)); }
+  void deallocate(T *, size_t) {}
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return true; }
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return false; }
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> ArenaString;
+
+#endif
@@ -1,19 +1,44 @@
 #include "ast.hpp"
 
-bool optimize = false;
+unsigned optimization_level = 0;
 bool final_code_stdout = false;
 bool intermediate_code_stdout = false;
-std::string filepath;
+bool object_code_output = false;
+bool streaming_optimization = false;
+bool time_report = false;
+bool run_program = false;
+bool interpret_program = false;
+bool bounds_check = false;
+bool tiered_execution = false;
+unsigned tier_threshold = 1000;
+std::string target_cpu = "generic";
+std::string target_features;
+std::string executable_path;
+std::string cache_directory;
+uint64_t cache_size_limit = 1024 * 1024 * 1024;
+thread_local std::string cache_key;
+thread_local std::string filepath;
+thread_local AtomTable atoms;
+thread_local Arena ast_arena;
+thread_local TypeTable types;
+thread_local Evaluator evaluator;
 
-llvm::LLVMContext AST::TheContext;
-llvm::IRBuilder<> AST::Builder(TheContext);
-std::unique_ptr<llvm::Module> AST::TheModule;
-std::unique_ptr<llvm::legacy::FunctionPassManager> AST::TheFPM;
+thread_local llvm::LLVMContext AST::TheContext;
+thread_local llvm::IRBuilder<> AST::Builder(TheContext);
+thread_local std::unique_ptr<llvm::Module> AST::TheModule;
+thread_local std::unique_ptr<llvm::legacy::FunctionPassManager> AST::TheFPM;
+thread_local std::unique_ptr<llvm::TargetMachine> AST::TheTargetMachine;
+thread_local std::unique_ptr<llvm::PassManagerBuilder> AST::ThePMB;
+thread_local llvm::SmallPtrSet<llvm::Function *, 16> AST::StreamedFunctions;
+thread_local std::string AST::TargetCPU;
+thread_local std::string AST::TargetFeatures;
 
-llvm::Type *AST::i8;
-llvm::Type *AST::i32;
-llvm::Type *AST::i64;
+thread_local llvm::Type *AST::i8;
+thread_local llvm::Type *AST::i32;
+thread_local llvm::Type *AST::i64;
 
-std::map<std::string, std::map<std::string, llvm::Value *>> AST::NamedValues;
-std::map<std::string, std::map<std::string,std::string> *> AST::FunctionTranslationTablesRealToLocal;
-std::map<std::string, std::map<std::string,std::string> *> AST::FunctionTranslationTablesLocalToReal;
+thread_local std::map<Atom, std::map<Atom, llvm::Value *>> AST::NamedValues;
+thread_local std::map<Atom, std::map<Atom, Atom> *> AST::FunctionTranslationTablesRealToLocal;
+thread_local std::map<Atom, std::map<Atom, Atom> *> AST::FunctionTranslationTablesLocalToReal;
+thread_local llvm::StringMap<llvm::GlobalVariable *> AST::StringConstants;
+thread_local std::unique_ptr<BytecodeBuilder> FunctionDefinition::Bytecode;
@@ -2,12 +2,24 @@
 
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include "symbol.hpp"
+#include "arena.hpp"
+#include "cache.hpp"
+#include "jit.hpp"
+#include "vm.hpp"
+#include "tier.hpp"
+#include "evaluator.hpp"
+#include "range.hpp"
+#include "timer.hpp"
 #include <memory>
 #include <fstream>
 #include <ctime>
+#include <mutex>
 
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Value.h>
@@ -17,6 +29,12 @@
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/Scalar/GVN.h>
 #include <llvm/Transforms/Utils.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
 
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
@@ -26,12 +44,22 @@
 #include "llvm/Target/TargetMachine.h"
 
 #include "llvm/Support/Host.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Program.h"
 
 // Define global flags
-extern bool optimize;
+extern unsigned optimization_level;
 extern bool final_code_stdout;
 extern bool intermediate_code_stdout;
-extern std::string filepath;
+extern bool object_code_output;
+extern bool streaming_optimization;
+extern bool interpret_program;
+extern bool bounds_check;
+extern std::string target_cpu;
+extern std::string target_features;
+extern std::string executable_path;
+extern thread_local std::string filepath;
 
 extern void yyerror2(const char *msg, int line_number);
 
@@ -39,6 +67,10 @@ class AST
 {
 public:
   virtual ~AST() {}
+
+  // the nodes live in the arena of the compilation, and go away with it
+  static void *operator new(size_t size) { return ast_arena.allocate(size); }
+  static void operator delete(void *) {}
   virtual void printOn(std::ostream &out) const = 0;
   virtual void sem() {}
 
@@ -66,38 +98,62 @@ public:
     }
   }
 
-  virtual std::string get_translation_real_to_local(std::string real_name) {
+  virtual Atom get_translation_real_to_local(Atom real_name) {
     // std::cout << "looking up real " << real_name << std::endl;
-    llvm::Function *Current_Function = Builder.GetInsertBlock()->getParent();
-    std::string current_function_name = std::string(Current_Function->getName());
+    Atom current_function_name = current_function();
     // std::cout << "returns " << (*FunctionTranslationTablesRealToLocal[current_function_name])[real_name] << std::endl;
     return (*FunctionTranslationTablesRealToLocal[current_function_name])[real_name];
   }
 
-  virtual std::string get_translation_local_to_real(std::string local_name) {
+  virtual Atom get_translation_local_to_real(Atom local_name) {
     // std::cout << "looking up local" << local_name << std::endl;
-    llvm::Function *Current_Function = Builder.GetInsertBlock()->getParent();
-    std::string current_function_name = std::string(Current_Function->getName());
+    Atom current_function_name = current_function();
     // std::cout << "returns " << (*FunctionTranslationTablesLocalToReal[current_function_name])[local_name] << std::endl;
     return (*FunctionTranslationTablesLocalToReal[current_function_name])[local_name];
   }
 
-  void llvm_compile_and_dump(bool optimize = true)
+  // the codegen maps key on the atoms of the llvm names
+  static Atom name_atom(const llvm::Value *V) {
+    llvm::StringRef name = V->getName();
+    return atoms.intern(name.data(), name.size());
+  }
+
+  static Atom current_function() {
+    return name_atom(Builder.GetInsertBlock()->getParent());
+  }
+
+  // the hidden parameter with the first dimension of an array parameter of unknown size
+  static Atom size_atom(Atom array) {
+    return atoms.intern(atoms.name(array) + ".size");
+  }
+
+  /*
+  * Sets up the module before the parser reaches the first function.
+  * The functions are generated into it as soon as they are parsed,
+  * and llvm_compile_and_dump() finishes it once the program is over.
+  */
+  static void llvm_start_module(unsigned opt_level = 0)
   {
+    PhaseTimer codegen_timer("codegen");
+    llvm::TargetMachine *TheTargetMachine = get_target_machine(opt_level);
+
     // Initialize
+    TheFPM.reset();
     TheModule = std::make_unique<llvm::Module>("grace program", TheContext);
+    TheModule->setTargetTriple(TheTargetMachine->getTargetTriple().str());
+    TheModule->setDataLayout(TheTargetMachine->createDataLayout());
     TheFPM = std::make_unique<llvm::legacy::FunctionPassManager>(TheModule.get());
-    NamedValues = std::map<std::string,std::map<std::string, llvm::Value *>>();
-    FunctionTranslationTablesRealToLocal = std::map<std::string, std::map<std::string,std::string> *>();
-    FunctionTranslationTablesLocalToReal = std::map<std::string, std::map<std::string,std::string> *>();
+    NamedValues = std::map<Atom, std::map<Atom, llvm::Value *>>();
+    FunctionTranslationTablesRealToLocal = std::map<Atom, std::map<Atom, Atom> *>();
+    FunctionTranslationTablesLocalToReal = std::map<Atom, std::map<Atom, Atom> *>();
+    StringConstants.clear();
+    StreamedFunctions.clear();
     // NamedFunctions = std::map<std::string, llvm::Function *>();
-    if (optimize)
+    if (opt_level > 0)
     {
-      TheFPM->add(llvm::createPromoteMemoryToRegisterPass());
-      // TheFPM->add(llvm::createInstructionCombiningPass());
-      TheFPM->add(llvm::createReassociatePass());
-      TheFPM->add(llvm::createGVNPass());
-      TheFPM->add(llvm::createCFGSimplificationPass());
+      llvm::PassManagerBuilder *PMB = get_pass_manager_builder(TheTargetMachine, opt_level);
+      TheFPM->add(llvm::createTargetTransformInfoWrapperPass(TheTargetMachine->getTargetIRAnalysis()));
+      PMB->populateFunctionPassManager(*TheFPM);
     }
     TheFPM->doInitialization();
     // Initialize types
@@ -113,75 +169,338 @@ public:
     llvm::Function *main =
       llvm::Function::Create(main_type, llvm::Function::ExternalLinkage,
                        "main", TheModule.get());
+    set_target_attributes(main);
     llvm::BasicBlock *BB = llvm::BasicBlock::Create(TheContext, "entry", main);
     Builder.SetInsertPoint(BB);
-    // Emit the program code.
-    codegen();
+  }
+
+  // Verifies, optimizes and emits the module of the whole program
+  static void llvm_compile_and_dump(unsigned opt_level = 0)
+  {
+    PhaseTimer codegen_timer("codegen");
+    llvm::TargetMachine *TheTargetMachine = get_target_machine(opt_level);
+    llvm::Function *main = TheModule->getFunction("main");
+    Builder.SetInsertPoint(&main->back());
     Builder.CreateRet(c32(0));
     // Verify the IR.
     bool bad = verifyModule(*TheModule, &llvm::errs());
     if (bad) {
       std::cerr << "The IR is bad!" << std::endl;
       TheModule->print(llvm::errs(), nullptr);
-      exit(1);
+      error_exit();
     }
     // Optimize!
-    if (optimize)
-      TheFPM->run(*main);
+    if (opt_level > 0) {
+      PhaseTimer timer("optimize");
+      // Only main is reachable from outside the module
+      for (llvm::Function &F : *TheModule) {
+        if (!F.isDeclaration() && &F != main)
+          F.setLinkage(llvm::Function::InternalLinkage);
+      }
+      for (llvm::Function &F : *TheModule) {
+        if (F.isDeclaration())
+          continue;
+        // already optimized right after their codegen
+        if (StreamedFunctions.count(&F))
+          continue;
+        TheFPM->run(F);
+      }
+      TheFPM->doFinalization();
+      llvm::legacy::PassManager TheMPM;
+      TheMPM.add(llvm::createTargetTransformInfoWrapperPass(TheTargetMachine->getTargetIRAnalysis()));
+      get_pass_manager_builder(TheTargetMachine, opt_level)->populateModulePassManager(TheMPM);
+      TheMPM.run(*TheModule);
+    }
+
+    // Emit the final code
+    for (const std::string &kind : get_output_kinds()) {
+      PhaseTimer timer("emit");
+      std::string contents;
+      if (kind == "ll" || kind == "imm") {
+        llvm::raw_string_ostream out(contents);
+        TheModule->print(out, nullptr);
+        out.flush();
+      } else {
+        // Object code is emitted in-process, no textual IR round trip through llc
+        llvm::SmallString<0> buffer;
+        llvm::raw_svector_ostream out(buffer);
+        llvm::legacy::PassManager pass;
+        auto FileType = kind == "o" ? llvm::CGFT_ObjectFile : llvm::CGFT_AssemblyFile;
+        if (TheTargetMachine->addPassesToEmitFile(pass, out, nullptr, FileType)) {
+          std::cerr << "The target machine can't emit this file type" << std::endl;
+          error_exit();
+        }
+        pass.run(*TheModule);
+        contents = std::string(buffer.str());
+      }
+      if (!cache_directory.empty())
+        CompilationCache::store(cache_key, kind, contents);
+      PhaseTimer output_timer("output");
+      write_output(kind, contents);
+    }
+  }
+
+  /*
+  * The outputs of a compilation, depending on the flags:
+  * llvm code (ll) or assembly (s) in stdout, an object file (o)
+  * to keep, to link or to run, or the .imm and .asm files
+  */
+  static std::vector<std::string> get_output_kinds()
+  {
+    if (intermediate_code_stdout)
+      return { "ll" };
+    if (final_code_stdout)
+      return { "s" };
+    if (object_code_output || !executable_path.empty() || run_program)
+      return { "o" };
+    return { "imm", "asm" };
+  }
 
-    // Initialize all targets
-    llvm::InitializeAllTargetInfos();
-    llvm::InitializeAllTargets();
-    llvm::InitializeAllTargetMCs();
-    llvm::InitializeAllAsmPrinters();
+  static void write_output(const std::string &kind, llvm::StringRef contents)
+  {
+    if (kind == "ll" || kind == "s") {
+      llvm::outs() << contents;
+      llvm::outs().flush();
+      return;
+    }
+    if (kind == "o" && run_program) {
+      int status = JIT::run_object(contents);
+      if (status != 0) exit(status);
+      return;
+    }
+    bool link = kind == "o" && !object_code_output;
+    llvm::SmallString<128> path(filepath + "." + kind);
+    if (kind == "o" && !executable_path.empty())
+      path = executable_path;
+    if (link && llvm::sys::fs::createTemporaryFile("gracec", "o", path)) {
+      std::cerr << "Could not create temporary object file" << std::endl;
+      error_exit();
+    }
+    std::error_code EC;
+    llvm::raw_fd_ostream dest(path, EC, llvm::sys::fs::OF_None);
+    if (EC) {
+      std::cerr << "Could not open file: " << EC.message() << std::endl;
+      error_exit();
+    }
+    dest << contents;
+    dest.close();
+    if (link) {
+      int status = link_executable(std::string(path), executable_path);
+      llvm::sys::fs::remove(path);
+      if (status != 0) error_exit();
+    }
+  }
+
+  /*
+  * Everything that affects the outputs goes into the cache key:
+  * the compiler build, the source, the optimization level,
+  * the target and the kind of outputs requested
+  */
+  static std::string get_cache_key(llvm::StringRef source)
+  {
+    std::string cpu = target_cpu, features = target_features;
+    resolve_target_cpu(cpu, features);
+    std::string build_id = "gracec";
+    std::string executable = llvm::sys::fs::getMainExecutable(nullptr, (void *)&get_cache_key);
+    llvm::sys::fs::file_status status;
+    if (!llvm::sys::fs::status(executable, status)) {
+      build_id += " " + std::to_string(status.getSize()) + " " +
+                  std::to_string(llvm::sys::toTimeT(status.getLastModificationTime()));
+    }
+    std::vector<std::string> inputs = {
+      build_id, std::string(source), std::to_string(optimization_level),
+      streaming_optimization ? "streaming" : "", bounds_check ? "bounds-check" : "",
+      llvm::sys::getDefaultTargetTriple(), cpu, features
+    };
+    for (const std::string &kind : get_output_kinds())
+      inputs.push_back(kind);
+    return CompilationCache::hash(inputs);
+  }
+
+  /*
+  * Writes the outputs straight from the cache,
+  * if all of them are there
+  */
+  static bool write_cached_outputs()
+  {
+    std::vector<std::string> kinds = get_output_kinds();
+    std::vector<std::string> contents(kinds.size());
+    for (unsigned i = 0; i < kinds.size(); i++) {
+      if (!CompilationCache::lookup(cache_key, kinds[i], contents[i]))
+        return false;
+    }
+    for (unsigned i = 0; i < kinds.size(); i++)
+      write_output(kinds[i], contents[i]);
+    return true;
+  }
+
+  /*
+  * Frees the LLVM objects of the calling thread,
+  * before its context goes away with the thread
+  */
+  static void release_llvm_state()
+  {
+    TheFPM.reset();
+    TheModule.reset();
+    StreamedFunctions.clear();
+    ThePMB.reset();
+    TheTargetMachine.reset();
+  }
+
+  /*
+  * Links an object file against the runtime library (lib.a)
+  * with a single invocation of the system linker driver.
+  */
+  static int link_executable(const std::string &object_path, const std::string &output_path)
+  {
+    llvm::ErrorOr<std::string> linker = llvm::sys::findProgramByName("clang-11");
+    if (!linker)
+      linker = llvm::sys::findProgramByName("cc");
+    if (!linker) {
+      std::cerr << "Could not find a linker (clang-11 or cc)" << std::endl;
+      return 1;
+    }
+    std::vector<llvm::StringRef> args = { *linker, "-o", output_path, object_path, "lib.a" };
+    std::string error_message;
+    int status = llvm::sys::ExecuteAndWait(*linker, args, llvm::None, {}, 0, 0, &error_message);
+    if (status != 0) {
+      std::cerr << "Linking failed";
+      if (!error_message.empty()) std::cerr << ": " << error_message;
+      std::cerr << std::endl;
+    }
+    return status;
+  }
+
+protected:
+  static thread_local llvm::LLVMContext TheContext;
+  static thread_local llvm::IRBuilder<> Builder;
+  static thread_local std::unique_ptr<llvm::Module> TheModule;
+  static thread_local std::unique_ptr<llvm::legacy::FunctionPassManager> TheFPM;
+  static thread_local std::unique_ptr<llvm::TargetMachine> TheTargetMachine;
+  static thread_local std::unique_ptr<llvm::PassManagerBuilder> ThePMB;
+  // the functions -fstreaming-opt has run the function passes on
+  static thread_local llvm::SmallPtrSet<llvm::Function *, 16> StreamedFunctions;
+  static thread_local std::string TargetCPU;
+  static thread_local std::string TargetFeatures;
+
+  static thread_local llvm::Type *i8;
+  static thread_local llvm::Type *i32;
+  static thread_local llvm::Type *i64; //not used
+
+  /*
+  * The target machine is created once per thread and then
+  * shared by all the programs compiled by that thread
+  */
+  static llvm::TargetMachine *get_target_machine(unsigned opt_level)
+  {
+    if (TheTargetMachine)
+      return TheTargetMachine.get();
+
+    // Initialize all targets, once even with many compiling threads
+    static std::once_flag targets_initialized;
+    std::call_once(targets_initialized, []() {
+      llvm::InitializeAllTargetInfos();
+      llvm::InitializeAllTargets();
+      llvm::InitializeAllTargetMCs();
+      llvm::InitializeAllAsmPrinters();
+    });
 
     auto TargetTriple = llvm::sys::getDefaultTargetTriple();
-    TheModule->setTargetTriple(TargetTriple);
     std::string Error;
     auto Target = llvm::TargetRegistry::lookupTarget(TargetTriple, Error);
+    if (!Target) {
+      std::cerr << Error << std::endl;
+      error_exit();
+    }
 
-    auto CPU = "generic";
-    auto Features = "";
+    TargetCPU = target_cpu;
+    TargetFeatures = target_features;
+    resolve_target_cpu(TargetCPU, TargetFeatures);
 
     llvm::TargetOptions opt;
     auto RM = llvm::Optional<llvm::Reloc::Model>();
-    auto TheTargetMachine = Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
-
-    TheModule->setDataLayout(TheTargetMachine->createDataLayout());
-
-    // Emit assembly code
-    std::error_code EC;
-    llvm::raw_fd_ostream dest(filepath + ".asm", EC);
-
-    llvm::legacy::PassManager pass;
-    auto FileType = llvm::CGFT_AssemblyFile;
+    if (object_code_output || !executable_path.empty() || run_program)
+      RM = llvm::Reloc::PIC_; // linkable into both PIE and non-PIE executables, and loadable anywhere by the JIT
+    TheTargetMachine.reset(Target->createTargetMachine(TargetTriple, TargetCPU, TargetFeatures, opt, RM,
+                                                       llvm::None, get_codegen_opt_level(opt_level)));
+    return TheTargetMachine.get();
+  }
 
-    // Print out the IR.
-    if (intermediate_code_stdout) {
-      TheModule->print(llvm::outs(), nullptr);
-    } else if (final_code_stdout) {
-      TheTargetMachine->addPassesToEmitFile(pass, llvm::outs(), nullptr, FileType);
-    } else {
-      TheTargetMachine->addPassesToEmitFile(pass, dest, nullptr, FileType);
-      llvm::raw_fd_ostream dest(filepath + ".imm", EC);
-      TheModule->print(dest, nullptr);
+  /*
+  * Turns the native cpu into the host cpu name and features
+  */
+  static void resolve_target_cpu(std::string &cpu, std::string &features)
+  {
+    if (cpu != "native")
+      return;
+    cpu = std::string(llvm::sys::getHostCPUName());
+    llvm::StringMap<bool> HostFeatures;
+    if (llvm::sys::getHostCPUFeatures(HostFeatures)) {
+      llvm::SubtargetFeatures Features;
+      for (auto &Feature : HostFeatures)
+        Features.AddFeature(Feature.first(), Feature.second);
+      // explicit -mattr features come last so they override the host ones
+      if (!features.empty())
+        Features.AddFeature(features);
+      features = Features.getString();
     }
+  }
 
-     pass.run(*TheModule);
-     dest.flush();
-
+  /*
+  * Like the target machine, the pipeline configuration is built once.
+  * The inliner is owned by the pass manager it gets added to, so a
+  * fresh one is handed out for every module.
+  */
+  static llvm::PassManagerBuilder *get_pass_manager_builder(llvm::TargetMachine *TM, unsigned opt_level)
+  {
+    if (!ThePMB) {
+      ThePMB = std::make_unique<llvm::PassManagerBuilder>();
+      ThePMB->OptLevel = opt_level;
+      ThePMB->SizeLevel = 0;
+      ThePMB->LibraryInfo = new llvm::TargetLibraryInfoImpl(TM->getTargetTriple());
+      ThePMB->LoopVectorize = opt_level > 1;
+      ThePMB->SLPVectorize = opt_level > 1;
+      TM->adjustPassManager(*ThePMB);
+    }
+    if (!ThePMB->Inliner) {
+      if (opt_level > 1)
+        ThePMB->Inliner = llvm::createFunctionInliningPass(opt_level, 0, false);
+      else
+        ThePMB->Inliner = llvm::createAlwaysInlinerLegacyPass();
+    }
+    return ThePMB.get();
   }
 
-protected:
-  static llvm::LLVMContext TheContext;
-  static llvm::IRBuilder<> Builder;
-  static std::unique_ptr<llvm::Module> TheModule;
-  static std::unique_ptr<llvm::legacy::FunctionPassManager> TheFPM;
+  static llvm::CodeGenOpt::Level get_codegen_opt_level(unsigned opt_level)
+  {
+    switch (opt_level)
+    {
+    case 0:
+      return llvm::CodeGenOpt::None;
+    case 1:
+      return llvm::CodeGenOpt::Less;
+    case 2:
+      return llvm::CodeGenOpt::Default;
+    default:
+      return llvm::CodeGenOpt::Aggressive;
+    }
+  }
 
-  static llvm::Type *i8;
-  static llvm::Type *i32;
-  static llvm::Type *i64; //not used
+  /*
+  * Lets the backend use the selected cpu and features
+  * for the code of every function we define
+  */
+  static void set_target_attributes(llvm::Function *F)
+  {
+    F->addFnAttr("target-cpu", TargetCPU);
+    if (!TargetFeatures.empty())
+      F->addFnAttr("target-features", TargetFeatures);
+  }
 
+  static llvm::ConstantInt *c1(bool b)
+  {
+    return llvm::ConstantInt::get(TheContext, llvm::APInt(1, b));
+  }
   static llvm::ConstantInt *c8(char c)
   {
     return llvm::ConstantInt::get(TheContext, llvm::APInt(8, c, true));
@@ -191,54 +510,119 @@ protected:
     return llvm::ConstantInt::get(TheContext, llvm::APInt(32, n, true));
   }
 
-  void init_library() {
-    llvm::FunctionType *writeInteger_type =
-      llvm::FunctionType::get(llvm::Type::getVoidTy(TheContext), {i32}, false);
-    llvm::Function::Create(writeInteger_type, llvm::Function::ExternalLinkage, "writeInteger", TheModule.get());
-    llvm::FunctionType *writeString_type =
-      llvm::FunctionType::get(llvm::Type::getVoidTy(TheContext), {llvm::PointerType::get(i8, 0)}, false);
-    llvm::Function::Create(writeString_type, llvm::Function::ExternalLinkage, "writeString", TheModule.get());
-    llvm::FunctionType *writeChar_type =
-      llvm::FunctionType::get(llvm::Type::getVoidTy(TheContext), {i8}, false);
-    llvm::Function::Create(writeChar_type, llvm::Function::ExternalLinkage, "writeChar", TheModule.get());
-    llvm::FunctionType *readInteger_type =
-      llvm::FunctionType::get(llvm::Type::getInt32Ty(TheContext), {}, false);
-    llvm::Function::Create(readInteger_type, llvm::Function::ExternalLinkage, "readInteger", TheModule.get());
-    llvm::FunctionType *readString_type =
-      llvm::FunctionType::get(llvm::Type::getVoidTy(TheContext), {i32, llvm::PointerType::get(i8, 0)}, false);
-    llvm::Function::Create(readString_type, llvm::Function::ExternalLinkage, "readString", TheModule.get());
-    llvm::FunctionType *readChar_type =
-      llvm::FunctionType::get(llvm::Type::getInt8Ty(TheContext), {}, false);
-    llvm::Function::Create(readChar_type, llvm::Function::ExternalLinkage, "readChar", TheModule.get());
-    llvm::FunctionType *ascii_type =
-      llvm::FunctionType::get(llvm::Type::getInt32Ty(TheContext), {i8}, false);
-       llvm::Function *ord = llvm::Function::Create(ascii_type, llvm::Function::ExternalLinkage, "ord", TheModule.get());
-    llvm::Function *ascii = llvm::Function::Create(ascii_type, llvm::Function::ExternalLinkage, "ascii", TheModule.get());
-    llvm::BasicBlock *BB = llvm::BasicBlock::Create(TheContext, "entry", ascii);
-    Builder.SetInsertPoint(BB);
-    llvm::Value *arg = ascii->arg_begin();
-    llvm::Value *result = Builder.CreateCall(ord, arg);  
-    Builder.CreateRet(result);
-    llvm::FunctionType *chr_type =
-      llvm::FunctionType::get(llvm::Type::getInt8Ty(TheContext), {i32}, false);
-    llvm::Function::Create(chr_type, llvm::Function::ExternalLinkage, "chr", TheModule.get());
-    llvm::FunctionType *strlen_type =
-      llvm::FunctionType::get(llvm::Type::getInt32Ty(TheContext), {llvm::PointerType::get(i8, 0)}, false);
-    llvm::Function::Create(strlen_type, llvm::Function::ExternalLinkage, "strlen", TheModule.get());
-    llvm::FunctionType *strcmp_type =
-      llvm::FunctionType::get(llvm::Type::getInt32Ty(TheContext), {llvm::PointerType::get(i8, 0), llvm::PointerType::get(i8, 0)}, false);
-    llvm::Function::Create(strcmp_type, llvm::Function::ExternalLinkage, "strcmp", TheModule.get());
-    llvm::FunctionType *strcpy_type =
-      llvm::FunctionType::get(llvm::Type::getVoidTy(TheContext), {llvm::PointerType::get(i8, 0), llvm::PointerType::get(i8, 0)}, false);
-    llvm::Function::Create(strcpy_type, llvm::Function::ExternalLinkage, "strcpy", TheModule.get());
-    llvm::FunctionType *strcat_type =
-      llvm::FunctionType::get(llvm::Type::getVoidTy(TheContext), {llvm::PointerType::get(i8, 0), llvm::PointerType::get(i8, 0)}, false);
-    llvm::Function::Create(strcat_type, llvm::Function::ExternalLinkage, "strcat", TheModule.get());
-  }
-
-  static std::map<std::string, std::map<std::string, llvm::Value *>> NamedValues;
-  static std::map<std::string, std::map<std::string,std::string> *> FunctionTranslationTablesRealToLocal;
-  static std::map<std::string, std::map<std::string,std::string> *> FunctionTranslationTablesLocalToReal;
+  /*
+  * A pointer to the first character of a string constant of the module.
+  * Every occurrence of the same literal shares one global. The globals
+  * are private, constant and unnamed_addr, so the backend puts them in
+  * a mergeable string section and the linker can fold them further.
+  */
+  static llvm::Constant *string_constant(llvm::StringRef s)
+  {
+    llvm::GlobalVariable *&global = StringConstants[s];
+    if (global == nullptr) {
+      llvm::Constant *text = llvm::ConstantDataArray::getString(TheContext, s);
+      global = new llvm::GlobalVariable(*TheModule, text->getType(), true, llvm::GlobalValue::PrivateLinkage, text, "string");
+      global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+      global->setAlignment(llvm::MaybeAlign(1));
+    }
+    llvm::Constant *indices[] = {c32(0), c32(0)};
+    return llvm::ConstantExpr::getInBoundsGetElementPtr(global->getValueType(), global, indices);
+  }
+
+  /*
+  * What an index out of bounds calls under -fbounds-check: it prints
+  * the line of the access, after what the program wrote so far, and
+  * exits like the interpreter does on a runtime error. It is made the
+  * first time a check needs it, so that a program without checks
+  * declares none of the libc functions it calls.
+  */
+  static llvm::Function *bounds_error_function() {
+    llvm::Function *F = TheModule->getFunction("grace.bounds_error");
+    if (F != nullptr)
+      return F;
+    llvm::Type *void_type = llvm::Type::getVoidTy(TheContext);
+    llvm::Type *string_type = llvm::PointerType::get(i8, 0);
+    llvm::FunctionCallee fflush = TheModule->getOrInsertFunction("fflush", llvm::FunctionType::get(i32, {string_type}, false));
+    llvm::FunctionCallee dprintf = TheModule->getOrInsertFunction("dprintf", llvm::FunctionType::get(i32, {i32, string_type}, true));
+    llvm::FunctionCallee exit = TheModule->getOrInsertFunction("exit", llvm::FunctionType::get(void_type, {i32}, false));
+    F = llvm::Function::Create(llvm::FunctionType::get(void_type, {i32}, false), llvm::Function::InternalLinkage, "grace.bounds_error", TheModule.get());
+    set_target_attributes(F);
+    F->addFnAttr(llvm::Attribute::NoReturn);
+    F->addFnAttr(llvm::Attribute::Cold);
+    F->addFnAttr(llvm::Attribute::NoInline);
+    llvm::IRBuilder<> B(llvm::BasicBlock::Create(TheContext, "entry", F));
+    B.CreateCall(fflush, { llvm::ConstantPointerNull::get(llvm::PointerType::get(i8, 0)) });
+    B.CreateCall(dprintf, { c32(2), string_constant("Runtime error: Array index out of bounds at line %d\n"), &*F->arg_begin() });
+    B.CreateCall(exit, { c32(1) });
+    B.CreateUnreachable();
+    return F;
+  }
+
+  /*
+  * Declares the functions of lib.a with what they do to memory, so that
+  * the optimizer can keep values in registers across their calls, and
+  * hoist or drop the ones that only read. The I/O touches only memory
+  * the program can't see, and the string functions only the strings
+  * they are given. None of them unwinds or keeps a pointer it gets,
+  * and the arrays of a program are never null. Only the string
+  * functions surely return: the I/O may wait on its input forever, or
+  * end the program on a bad one. ascii and chr are not among them:
+  * FunctionCall generates them inline.
+  */
+  static void init_library() {
+    llvm::Type *void_type = llvm::Type::getVoidTy(TheContext);
+    llvm::Type *string_type = llvm::PointerType::get(i8, 0);
+    declare_library_function("writeInteger", void_type, {i32}, {llvm::Attribute::InaccessibleMemOnly});
+    llvm::Function *writeString =
+      declare_library_function("writeString", void_type, {string_type}, {llvm::Attribute::InaccessibleMemOrArgMemOnly});
+    writeString->addParamAttr(0, llvm::Attribute::ReadOnly);
+    declare_library_function("writeChar", void_type, {i8}, {llvm::Attribute::InaccessibleMemOnly});
+    declare_library_function("readInteger", i32, {}, {llvm::Attribute::InaccessibleMemOnly});
+    llvm::Function *readString =
+      declare_library_function("readString", void_type, {i32, string_type}, {llvm::Attribute::InaccessibleMemOrArgMemOnly});
+    readString->addParamAttr(1, llvm::Attribute::WriteOnly);
+    declare_library_function("readChar", i8, {}, {llvm::Attribute::InaccessibleMemOnly});
+    llvm::Function *strlen =
+      declare_library_function("strlen", i32, {string_type}, {llvm::Attribute::ArgMemOnly, llvm::Attribute::ReadOnly});
+    strlen->addFnAttr(llvm::Attribute::WillReturn);
+    strlen->addParamAttr(0, llvm::Attribute::ReadOnly);
+    llvm::Function *strcmp =
+      declare_library_function("strcmp", i32, {string_type, string_type}, {llvm::Attribute::ArgMemOnly, llvm::Attribute::ReadOnly});
+    strcmp->addFnAttr(llvm::Attribute::WillReturn);
+    strcmp->addParamAttr(0, llvm::Attribute::ReadOnly);
+    strcmp->addParamAttr(1, llvm::Attribute::ReadOnly);
+    llvm::Function *strcpy =
+      declare_library_function("strcpy", void_type, {string_type, string_type}, {llvm::Attribute::ArgMemOnly});
+    strcpy->addFnAttr(llvm::Attribute::WillReturn);
+    strcpy->addParamAttr(0, llvm::Attribute::WriteOnly);
+    strcpy->addParamAttr(1, llvm::Attribute::ReadOnly);
+    llvm::Function *strcat =
+      declare_library_function("strcat", void_type, {string_type, string_type}, {llvm::Attribute::ArgMemOnly});
+    strcat->addFnAttr(llvm::Attribute::WillReturn);
+    // the destination is both read, for where it ends, and written
+    strcat->addParamAttr(1, llvm::Attribute::ReadOnly);
+  }
+
+  static llvm::Function *declare_library_function(const char *name, llvm::Type *result, llvm::ArrayRef<llvm::Type *> params,
+                                                  std::initializer_list<llvm::Attribute::AttrKind> memory) {
+    llvm::FunctionType *type = llvm::FunctionType::get(result, params, false);
+    llvm::Function *F = llvm::Function::Create(type, llvm::Function::ExternalLinkage, name, TheModule.get());
+    for (llvm::Attribute::AttrKind kind : memory)
+      F->addFnAttr(kind);
+    F->addFnAttr(llvm::Attribute::NoUnwind);
+    for (llvm::Argument &arg : F->args()) {
+      if (!arg.getType()->isPointerTy())
+        continue;
+      arg.addAttr(llvm::Attribute::NoCapture);
+      arg.addAttr(llvm::Attribute::NonNull);
+    }
+    return F;
+  }
+
+  static thread_local std::map<Atom, std::map<Atom, llvm::Value *>> NamedValues;
+  static thread_local std::map<Atom, std::map<Atom, Atom> *> FunctionTranslationTablesRealToLocal;
+  static thread_local std::map<Atom, std::map<Atom, Atom> *> FunctionTranslationTablesLocalToReal;
+  static thread_local llvm::StringMap<llvm::GlobalVariable *> StringConstants;
 };
 
 inline std::ostream &operator<<(std::ostream &out, const AST &t)
@@ -264,11 +648,55 @@ inline std::ostream &operator<<(std::ostream &out, DataType t)
   return out;
 }
 
+// The kinds of nodes of an operator tree, once it is flattened (see Operator)
+enum class FlatKind : uint8_t { Leaf, IntConst, CharConst, BoolConst, Negative, Not, BinOp };
+
 class Expr : public AST
 {
 public:
   virtual int eval() const = 0;
 
+  // what the flattening of an operator tree needs to know of its nodes:
+  // their kind, their operands, and the operator or the constant they are
+  virtual FlatKind get_flat_node(Expr *operands[2], char &op, int &value) const { return FlatKind::Leaf; }
+
+  /*
+  * The fold pass, after sem: folds the constant parts of the
+  * expression, and tells whether all of it is a constant, and which.
+  * folded() gives back a constant in place of an expression that is.
+  */
+  virtual bool fold(int &value) { return false; }
+  static Expr *folded(Expr *e);
+
+  // the value of a constant node
+  virtual bool get_constant(int &value) const { return false; }
+
+  // comparisons and the operators on them, whose values are i1 in the llvm code
+  virtual bool is_condition() const { return false; }
+
+  /*
+  * The range analysis of -fbounds-check: the values the expression can
+  * have where the variables have the ones of env, which also tells its
+  * array accesses whether their indices are in bounds. refine() narrows
+  * env down to where the expression, a condition, is true or false, and
+  * narrow() a variable down to the values that compare with bound.
+  */
+  virtual Interval range(const RangeEnv &env)
+  {
+    int value;
+    if (type == DataType::TYPE_int && get_constant(value))
+      return Interval::of(value);
+    return Interval::all();
+  }
+
+  virtual void refine(RangeEnv &env, bool when) {}
+  virtual void narrow(RangeEnv &env, char op, Interval bound) {}
+
+  // the first dimension of an array, which only an array parameter of unknown size gets when it runs
+  virtual llvm::Value *codegen_first_dimension() {
+    return c32(shape->dimensions[0]);
+  }
+
   virtual llvm::Value *llvm_get_array_offset(std::vector<llvm::Value *> * indices) {
     return 0;
   }
@@ -285,17 +713,51 @@ public:
     return nullptr;
   };
 
+  /*
+  * Lowering to bytecode: the value of the expression, its address
+  * (l-values, arrays and by-reference arguments), a jump on its
+  * truth value (conditions) or a store to it (assignments)
+  */
+  virtual int lower_value(BytecodeBuilder &B) = 0;
+
+  virtual int lower_address(BytecodeBuilder &B) {
+    return lower_value(B);
+  }
+
+  virtual void lower_branch(BytecodeBuilder &B, bool when, int label) {
+    int r = lower_value(B);
+    B.emit_jump(when ? Op::JNZ : Op::JZ, label, r);
+  }
+
+  virtual void lower_store(BytecodeBuilder &B, Expr *value) {
+    int address = lower_address(B);
+    int r = value->lower_value(B);
+    B.emit(type == DataType::TYPE_char ? Op::STORE8 : Op::STORE32, address, r);
+  }
+
+  static int byte_size(DataType t) {
+    return t == DataType::TYPE_char ? 1 : 4;
+  }
+
   int line_number = 0;
 
-  void type_check(DataType t, std::vector<int> dim = {})
+  void type_check(DataType t, const Shape *s = types.scalar())
+  {
+    check_types(type, shape, t, s, line_number);
+  }
+
+  // type_check, for the nodes of a flattened operator tree too
+  static void check_types(DataType type, const Shape *shape, DataType t, const Shape *s, int line_number)
   {
     if (type != t)
     {
       yyerror2("Type mismatch", line_number);
       // yyerror("Type mismatch");
     }
-    if (dimensions != dim)
+    // the shapes are hash-consed, only different ones need to be looked into
+    if (shape != s)
     {
+      const std::vector<int> &dimensions = shape->dimensions, &dim = s->dimensions;
       if (dimensions.empty() || dim.empty())
       {
         yyerror2("Type mismatch, array and non-array", line_number);
@@ -328,9 +790,14 @@ public:
     return kind;
   }
 
-  std::vector<int> get_dimensions() const
+  const Shape *get_shape() const
   {
-    return dimensions;
+    return shape;
+  }
+
+  const std::vector<int> &get_dimensions() const
+  {
+    return shape->dimensions;
   }
 
   virtual bool is_rvalue() const
@@ -339,15 +806,29 @@ public:
   }
 
 protected:
-  DataType type;
-  EntryKind kind;
-  std::vector<int> dimensions;
+  DataType type = DataType::TYPE_nothing;
+  EntryKind kind = EntryKind::VARIABLE;
+  const Shape *shape = types.scalar();
 };
 
 class Stmt : public AST
 {
 public:
   virtual void run() const = 0;
+  virtual void lower(BytecodeBuilder &B) = 0;
+
+  /*
+  * The fold pass of a statement, which it may give back a simpler one
+  * for. An unconditional statement runs whenever its function body
+  * gets to it, which lets the values of its assignments be propagated.
+  */
+  virtual Stmt *fold(bool unconditional) { return this; }
+
+  // whether the statement returns on every path, so that nothing after it runs
+  virtual bool returns() const { return false; }
+
+  // takes env, the ranges of the variables before the statement, to the ones after it
+  virtual void range(RangeEnv &env) {}
 };
 // unused
 // class VarDecl: public Stmt {
@@ -375,6 +856,692 @@ public:
 //   std::vector<std::tuple<DataType, std::string>> params;
 // };
 
+/*
+* The operators of the expressions. They are checked, generated and
+* lowered from a flat copy of their operator tree: its nodes in
+* post-order in one array, with 32-bit indices for the operands, which
+* the passes walk in loops that switch on the kind of the node instead
+* of recursing through virtual calls. Only the operators and the
+* constants are flattened. The other nodes (variables, array elements,
+* calls, strings, and the short-circuit operators, which branch around
+* their right operand) are the leaves of the tree, which the loops
+* hand back to the class hierarchy. The tree is flattened once, by
+* the sem of its root; the nodes of the AST stay, for printOn and eval.
+*/
+class Operator : public Expr
+{
+public:
+  virtual bool is_rvalue() const override
+  {
+    return true;
+  }
+
+  virtual void sem() override
+  {
+    FlatExpr &f = flat();
+    for (uint32_t i = 0; i < f.nodes.size(); i++)
+    {
+      FlatNode &n = f.nodes[i];
+      switch (n.kind)
+      {
+      case FlatKind::IntConst:
+        n.type = DataType::TYPE_int;
+        continue;
+      case FlatKind::CharConst:
+        n.type = DataType::TYPE_char;
+        continue;
+      case FlatKind::BoolConst:
+        n.type = DataType::TYPE_int;
+        continue;
+      case FlatKind::Leaf:
+        f.exprs[i]->sem();
+        n.type = f.exprs[i]->get_type();
+        n.shape = f.exprs[i]->get_shape();
+        continue;
+      case FlatKind::Negative:
+        n.type = f.nodes[n.left].type;
+        n.shape = f.nodes[n.left].shape;
+        if (get_kind(f, n.left) == EntryKind::FUNCTION)
+        {
+          yyerror2("Cannot negate a function", n.line_number);
+        }
+        break;
+      case FlatKind::Not:
+        break;
+      case FlatKind::BinOp:
+        {
+          if (get_kind(f, n.left) == EntryKind::FUNCTION)
+          {
+            yyerror2("left operand cannot be a function", n.line_number);
+          }
+          if (get_kind(f, n.right) == EntryKind::FUNCTION)
+          {
+            yyerror2("right operand cannot be a function", n.line_number);
+          }
+          const FlatNode &l = f.nodes[n.left], &r = f.nodes[n.right];
+          check_types(l.type, l.shape, r.type, r.shape, l.line_number);
+          n.type = l.type;
+          if (l.shape->is_scalar() || l.shape->dimensions.front() == 0)
+            n.shape = r.shape;
+          else
+            n.shape = l.shape;
+        }
+        break;
+      }
+      // the operators of the AST get their types too
+      Operator *o = static_cast<Operator *>(f.exprs[i]);
+      o->type = n.type;
+      o->shape = n.shape;
+    }
+  }
+
+  virtual llvm::Value *codegen() override
+  {
+    FlatExpr &f = flat();
+    std::vector<llvm::Value *> values(f.nodes.size());
+    for (uint32_t i = 0; i < f.nodes.size(); i++)
+    {
+      const FlatNode &n = f.nodes[i];
+      llvm::Value *V = nullptr;
+      switch (n.kind)
+      {
+      case FlatKind::IntConst:
+        V = c32(n.value);
+        break;
+      case FlatKind::CharConst:
+        V = c8(n.value);
+        break;
+      case FlatKind::BoolConst:
+        V = c1(n.value);
+        break;
+      case FlatKind::Leaf:
+        V = f.exprs[i]->codegen();
+        break;
+      case FlatKind::Negative:
+        if (values[n.left])
+          V = Builder.CreateNeg(values[n.left], "negtmp");
+        break;
+      case FlatKind::Not:
+        if (values[n.left])
+          V = Builder.CreateNot(values[n.left], "nottmp");
+        break;
+      case FlatKind::BinOp:
+        V = codegen_binop(n.op, values[n.left], values[n.right]);
+        break;
+      }
+      // an operand of a binary operator is loaded as soon as it is computed
+      while (n.load && V->getType()->isPointerTy())
+      {
+        llvm::Value *tmp = Builder.CreateGEP(V, c32(0));
+        V = Builder.CreateLoad(tmp);
+      }
+      values[i] = V;
+    }
+    return values.back();
+  }
+
+  virtual int lower_value(BytecodeBuilder &B) override
+  {
+    std::vector<int> registers;
+    lower_nodes(B, registers, flat().nodes.size());
+    return registers.back();
+  }
+
+  virtual void lower_branch(BytecodeBuilder &B, bool when, int label) override
+  {
+    lower_branch_at(B, flat().nodes.size() - 1, when, label);
+  }
+
+  /*
+  * Folds the nodes in post-order, so that each one knows whether its
+  * operands are constants when it is folded. A subtree that turns out
+  * constant becomes a constant node, and the nodes under it go.
+  */
+  virtual bool fold(int &value) override
+  {
+    FlatExpr &f = flat();
+    bool changed = false;
+    for (uint32_t i = 0; i < f.nodes.size(); i++)
+    {
+      FlatNode &n = f.nodes[i];
+      int v = 0;
+      bool known = false;
+      switch (n.kind)
+      {
+      case FlatKind::IntConst:
+      case FlatKind::CharConst:
+      case FlatKind::BoolConst:
+        continue;
+      case FlatKind::Leaf:
+        known = f.exprs[i]->fold(v);
+        break;
+      case FlatKind::Negative:
+      case FlatKind::Not:
+        known = is_constant(f.nodes[n.left]) && evaluate(n, f.nodes[n.left], f.nodes[n.left], v);
+        break;
+      case FlatKind::BinOp:
+        known = is_constant(f.nodes[n.left]) && is_constant(f.nodes[n.right]) && evaluate(n, f.nodes[n.left], f.nodes[n.right], v);
+        break;
+      }
+      if (!known)
+        continue;
+      if (is_condition(f, i))
+        n.kind = FlatKind::BoolConst;
+      else
+        n.kind = n.type == DataType::TYPE_char ? FlatKind::CharConst : FlatKind::IntConst;
+      n.value = v;
+      changed = true;
+    }
+    if (is_constant(f.nodes.back()))
+    {
+      value = f.nodes.back().value;
+      return true;
+    }
+    if (changed)
+      drop_folded(f);
+    return false;
+  }
+
+  virtual Interval range(const RangeEnv &env) override
+  {
+    std::vector<Interval> ranges;
+    range_nodes(env, ranges);
+    return ranges.back();
+  }
+
+  virtual void refine(RangeEnv &env, bool when) override
+  {
+    std::vector<Interval> ranges;
+    range_nodes(env, ranges);
+    refine_at(ranges, flat().nodes.size() - 1, env, when);
+  }
+
+protected:
+  enum : uint32_t { none = UINT32_MAX };
+
+  struct FlatNode {
+    const Shape *shape;
+    FlatKind kind;
+    char op;
+    bool load;            // an operand of a binary operator
+    bool immediate;       // a constant that its parent adds in its own instruction
+    DataType type;
+    uint32_t left;
+    uint32_t right;
+    int32_t value;        // of a constant
+    int line_number;
+  };
+
+  struct FlatExpr {
+    ArenaVector<FlatNode> nodes;
+    ArenaVector<Expr *> exprs;  // the node of the AST of each
+  };
+
+  FlatExpr &flat()
+  {
+    if (flat_form == nullptr)
+    {
+      flat_form = ast_arena.make<FlatExpr>();
+      flatten(this, *flat_form);
+    }
+    return *flat_form;
+  }
+
+  // lowers the first count nodes of the tree
+  void lower_nodes(BytecodeBuilder &B, std::vector<int> &registers, uint32_t count)
+  {
+    FlatExpr &f = flat();
+    registers.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      const FlatNode &n = f.nodes[i];
+      int r = -1;
+      switch (n.kind)
+      {
+      case FlatKind::IntConst:
+      case FlatKind::CharConst:
+      case FlatKind::BoolConst:
+        if (n.immediate)
+          break;
+        r = B.reg();
+        B.emit(Op::CONST, r, n.value);
+        break;
+      case FlatKind::Leaf:
+        r = f.exprs[i]->lower_value(B);
+        break;
+      case FlatKind::Negative:
+        r = registers[n.left];
+        B.emit(Op::NEG, r, r);
+        if (n.type == DataType::TYPE_char)
+          B.emit(Op::SEXT8, r, r);
+        break;
+      case FlatKind::Not:
+        r = registers[n.left];
+        B.emit(Op::NOT, r, r);
+        break;
+      case FlatKind::BinOp:
+        r = registers[n.left];
+        if (f.nodes[n.right].immediate)
+          B.emit(Op::ADDI, r, r, n.op == '+' ? f.nodes[n.right].value : -f.nodes[n.right].value);
+        else
+          B.emit(get_lower_op(n.op), r, r, registers[n.right]);
+        if (n.type == DataType::TYPE_char && !is_comparison(n.op))
+          B.emit(Op::SEXT8, r, r);
+        break;
+      }
+      registers[i] = r;
+    }
+  }
+
+  static bool is_comparison(char op)
+  {
+    return op == '=' || op == '#' || op == '<' || op == '>' || op == 'l' || op == 'g';
+  }
+
+  static char get_inverse_comparison(char op)
+  {
+    switch (op)
+    {
+    case '=': return '#';
+    case '#': return '=';
+    case '<': return 'g';
+    case '>': return 'l';
+    case 'l': return '>';
+    default: return '<';
+    }
+  }
+
+  // the comparison with its operands the other way around
+  static char get_swapped_comparison(char op)
+  {
+    switch (op)
+    {
+    case '<': return '>';
+    case '>': return '<';
+    case 'l': return 'g';
+    case 'g': return 'l';
+    default: return op;
+    }
+  }
+
+  /*
+  * The ranges of the nodes, in post-order like the rest of the passes.
+  * The values of chars are left alone: they wrap around at 8 bits, and
+  * they are never indices.
+  */
+  void range_nodes(const RangeEnv &env, std::vector<Interval> &ranges)
+  {
+    FlatExpr &f = flat();
+    ranges.resize(f.nodes.size());
+    for (uint32_t i = 0; i < f.nodes.size(); i++)
+    {
+      const FlatNode &n = f.nodes[i];
+      Interval r = Interval::all();
+      switch (n.kind)
+      {
+      case FlatKind::IntConst:
+      case FlatKind::BoolConst:
+        r = Interval::of(n.value);
+        break;
+      case FlatKind::CharConst:
+        break;
+      case FlatKind::Leaf:
+        r = f.exprs[i]->range(env);
+        break;
+      case FlatKind::Negative:
+        if (n.type == DataType::TYPE_int)
+          r = Interval::make(-ranges[n.left].hi, -ranges[n.left].lo);
+        break;
+      case FlatKind::Not:
+        r = { 0, 1 };
+        break;
+      case FlatKind::BinOp:
+        if (is_comparison(n.op))
+          r = { 0, 1 };
+        else if (n.type == DataType::TYPE_int)
+          r = range_binop(n.op, ranges[n.left], ranges[n.right]);
+        break;
+      }
+      ranges[i] = r;
+    }
+  }
+
+  static Interval range_binop(char op, Interval l, Interval r)
+  {
+    switch (op)
+    {
+    case '+':
+      return Interval::make(l.lo + r.lo, l.hi + r.hi);
+    case '-':
+      return Interval::make(l.lo - r.hi, l.hi - r.lo);
+    }
+    bool nonzero = r.lo > 0 || r.hi < 0;
+    if (op == '%')
+    {
+      if (!nonzero)
+        return Interval::all();
+      // the remainder has the sign of the dividend, and is smaller than the divisor
+      int64_t m = std::max(std::abs(r.lo), std::abs(r.hi)) - 1;
+      if (l.lo >= 0)
+        return { 0, std::min(m, l.hi) };
+      if (l.hi <= 0)
+        return { std::max(-m, l.lo), 0 };
+      return { -m, m };
+    }
+    if (op == '/' && !nonzero)
+      return Interval::all();
+    // both are monotonic in each operand, on a divisor of one sign
+    int64_t corners[4];
+    for (int k = 0; k < 4; k++)
+    {
+      int64_t a = k & 1 ? l.hi : l.lo, b = k & 2 ? r.hi : r.lo;
+      corners[k] = op == '*' ? a * b : a / b;
+    }
+    return Interval::make(*std::min_element(corners, corners + 4), *std::max_element(corners, corners + 4));
+  }
+
+  // narrows env down to where node i, the root or a node under it through nots, is true or false
+  void refine_at(const std::vector<Interval> &ranges, uint32_t i, RangeEnv &env, bool when)
+  {
+    FlatExpr &f = flat();
+    const FlatNode &n = f.nodes[i];
+    switch (n.kind)
+    {
+    case FlatKind::BoolConst:
+      if ((n.value != 0) != when)
+        env.reachable = false;
+      return;
+    case FlatKind::Leaf:
+      f.exprs[i]->refine(env, when);
+      return;
+    case FlatKind::Not:
+      refine_at(ranges, n.left, env, !when);
+      return;
+    case FlatKind::BinOp:
+      if (is_comparison(n.op))
+      {
+        char cmp = when ? n.op : get_inverse_comparison(n.op);
+        if (f.nodes[n.left].kind == FlatKind::Leaf)
+          f.exprs[n.left]->narrow(env, cmp, ranges[n.right]);
+        if (f.nodes[n.right].kind == FlatKind::Leaf)
+          f.exprs[n.right]->narrow(env, get_swapped_comparison(cmp), ranges[n.left]);
+      }
+      return;
+    default:
+      return;
+    }
+  }
+
+  /*
+  * A jump on node i, whose operands are all the nodes before it: the
+  * root, or a node under the root through nothing but nots
+  */
+  void lower_branch_at(BytecodeBuilder &B, uint32_t i, bool when, int label)
+  {
+    FlatExpr &f = flat();
+    const FlatNode &n = f.nodes[i];
+    std::vector<int> registers;
+    switch (n.kind)
+    {
+    case FlatKind::IntConst:
+    case FlatKind::CharConst:
+    case FlatKind::BoolConst:
+      if ((n.value != 0) == when)
+        B.emit_jump(Op::JMP, label);
+      return;
+    case FlatKind::Leaf:
+      f.exprs[i]->lower_branch(B, when, label);
+      return;
+    case FlatKind::Not:
+      lower_branch_at(B, n.left, !when, label);
+      return;
+    case FlatKind::BinOp:
+      if (is_comparison(n.op))
+      {
+        // the operands, and not the comparison itself
+        static const std::map<char, Op> jumps = {
+          { '=', Op::JEQ }, { '#', Op::JNE }, { '<', Op::JLT }, { '>', Op::JGT }, { 'l', Op::JLE }, { 'g', Op::JGE }
+        };
+        lower_nodes(B, registers, i);
+        char cmp = when ? n.op : get_inverse_comparison(n.op);
+        B.emit_jump(jumps.at(cmp), label, registers[n.left], registers[n.right]);
+        return;
+      }
+      break;
+    case FlatKind::Negative:
+      break;
+    }
+    lower_nodes(B, registers, i + 1);
+    B.emit_jump(when ? Op::JNZ : Op::JZ, label, registers[i]);
+  }
+
+  static Op get_lower_op(char op)
+  {
+    switch (op)
+    {
+    case '+': return Op::ADD;
+    case '-': return Op::SUB;
+    case '*': return Op::MUL;
+    case '/': return Op::DIV;
+    case '%': return Op::MOD;
+    case '=': return Op::EQ;
+    case '#': return Op::NE;
+    case '<': return Op::LT;
+    case '>': return Op::GT;
+    case 'l': return Op::LE;
+    default: return Op::GE;
+    }
+  }
+
+  //for non short-cirtuiting binary operators
+  static llvm::Value *codegen_binop(char op, llvm::Value *l, llvm::Value *r)
+  {
+    switch (op)
+    {
+    case '+':
+      return Builder.CreateAdd(l, r, "addtmp");
+    case '-':
+      return Builder.CreateSub(l, r, "subtmp");
+    case '*':
+      return Builder.CreateMul(l, r, "multmp");
+    case '/':
+      return Builder.CreateSDiv(l, r, "divtmp");
+    case '%':
+      return Builder.CreateSRem(l, r, "modtmp");
+    case '=':
+      return Builder.CreateICmpEQ(l, r, "eqtmp");
+    case '#':
+      return Builder.CreateICmpNE(l, r, "netmp");
+    case '<':
+      return Builder.CreateICmpSLT(l, r, "lttmp");
+    case '>':
+      return Builder.CreateICmpSGT(l, r, "gttmp");
+    case 'l':
+      return Builder.CreateICmpSLE(l, r, "letmp");
+    case 'g':
+      return Builder.CreateICmpSGE(l, r, "getmp");
+    }
+    return nullptr;
+  }
+
+private:
+  FlatExpr *flat_form = nullptr;
+
+  static bool is_constant(const FlatNode &n)
+  {
+    return n.kind == FlatKind::IntConst || n.kind == FlatKind::CharConst || n.kind == FlatKind::BoolConst;
+  }
+
+  static bool is_condition(const FlatExpr &f, uint32_t i)
+  {
+    const FlatNode &n = f.nodes[i];
+    return n.kind == FlatKind::Not || (n.kind == FlatKind::BinOp && is_comparison(n.op)) || (n.kind == FlatKind::Leaf && f.exprs[i]->is_condition());
+  }
+
+  // the value the node has in the llvm code: ints wrap around at 32 bits and chars at 8
+  static int wrap(DataType type, uint32_t value)
+  {
+    return type == DataType::TYPE_char ? (int)(int8_t)value : (int)(int32_t)value;
+  }
+
+  /*
+  * The value of an operator on constant operands, unless it has none:
+  * a division by zero, or of the least value by -1, is left for the
+  * code to do when it runs
+  */
+  static bool evaluate(const FlatNode &n, const FlatNode &l, const FlatNode &r, int &value)
+  {
+    if (n.kind == FlatKind::Negative)
+    {
+      value = wrap(n.type, 0u - (uint32_t)l.value);
+      return true;
+    }
+    if (n.kind == FlatKind::Not)
+    {
+      value = !l.value;
+      return true;
+    }
+    switch (n.op)
+    {
+    case '+': value = wrap(n.type, (uint32_t)l.value + (uint32_t)r.value); return true;
+    case '-': value = wrap(n.type, (uint32_t)l.value - (uint32_t)r.value); return true;
+    case '*': value = wrap(n.type, (uint32_t)l.value * (uint32_t)r.value); return true;
+    case '=': value = l.value == r.value; return true;
+    case '#': value = l.value != r.value; return true;
+    case '<': value = l.value < r.value; return true;
+    case '>': value = l.value > r.value; return true;
+    case 'l': value = l.value <= r.value; return true;
+    case 'g': value = l.value >= r.value; return true;
+    }
+    int least = n.type == DataType::TYPE_char ? INT8_MIN : INT32_MIN;
+    if (r.value == 0 || (l.value == least && r.value == -1))
+      return false;
+    value = wrap(n.type, n.op == '/' ? l.value / r.value : l.value % r.value);
+    return true;
+  }
+
+  // drops the nodes under the constant ones, and the rest keep their order
+  static void drop_folded(FlatExpr &f)
+  {
+    uint32_t size = f.nodes.size();
+    std::vector<bool> keep(size, false);
+    keep[size - 1] = true;
+    for (uint32_t i = size; i-- > 0;)
+    {
+      if (!keep[i] || is_constant(f.nodes[i]))
+        continue;
+      if (f.nodes[i].left != none)
+        keep[f.nodes[i].left] = true;
+      if (f.nodes[i].right != none)
+        keep[f.nodes[i].right] = true;
+    }
+    std::vector<uint32_t> index(size);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < size; i++)
+    {
+      if (!keep[i])
+        continue;
+      index[i] = count;
+      f.nodes[count] = f.nodes[i];
+      f.exprs[count] = f.exprs[i];
+      count++;
+    }
+    f.nodes.resize(count);
+    f.exprs.resize(count);
+    for (FlatNode &n : f.nodes)
+    {
+      if (is_constant(n))
+      {
+        n.left = none;
+        n.right = none;
+        continue;
+      }
+      if (n.left != none)
+        n.left = index[n.left];
+      if (n.right != none)
+        n.right = index[n.right];
+      // a constant that the operator now has on its right can be added in its instruction
+      if (n.kind == FlatKind::BinOp && (n.op == '+' || n.op == '-') && f.nodes[n.right].kind == FlatKind::IntConst)
+        f.nodes[n.right].immediate = true;
+    }
+  }
+
+  static EntryKind get_kind(const FlatExpr &f, uint32_t i)
+  {
+    return f.nodes[i].kind == FlatKind::Leaf ? f.exprs[i]->get_kind() : EntryKind::VARIABLE;
+  }
+
+  struct Pending {
+    Expr *e;
+    uint32_t parent;
+    int side;
+  };
+
+  /*
+  * Walks the tree node, right operand, left operand, which is
+  * post-order backwards, and then reverses it. The stack only holds
+  * the left operands still to walk, so it stays small for the long
+  * chains of left-associative operators.
+  */
+  static void flatten(Expr *root, FlatExpr &f)
+  {
+    // built in buffers that the thread reuses, and copied to the arena at their final size
+    static thread_local std::vector<Pending> thread_stack;
+    static thread_local std::vector<FlatNode> thread_nodes;
+    static thread_local std::vector<Expr *> thread_exprs;
+    std::vector<Pending> &stack = thread_stack;
+    std::vector<FlatNode> &nodes = thread_nodes;
+    std::vector<Expr *> &exprs = thread_exprs;
+    nodes.clear();
+    exprs.clear();
+    const Shape *scalar = types.scalar();
+    stack.push_back({ root, none, 0 });
+    while (!stack.empty())
+    {
+      Pending p = stack.back();
+      stack.pop_back();
+      Expr *operands[2] = { nullptr, nullptr };
+      FlatNode n;
+      n.op = 0;
+      n.value = 0;
+      n.kind = p.e->get_flat_node(operands, n.op, n.value);
+      n.load = false;
+      n.immediate = false;
+      n.type = p.e->get_type();
+      n.left = none;
+      n.right = none;
+      n.shape = scalar;
+      n.line_number = p.e->line_number;
+      uint32_t index = nodes.size();
+      if (p.parent != none)
+      {
+        FlatNode &parent = nodes[p.parent];
+        (p.side == 0 ? parent.left : parent.right) = index;
+        n.load = parent.kind == FlatKind::BinOp;
+        n.immediate = p.side == 1 && n.kind == FlatKind::IntConst && (parent.op == '+' || parent.op == '-');
+      }
+      nodes.push_back(n);
+      exprs.push_back(p.e);
+      if (operands[0] != nullptr)
+        stack.push_back({ operands[0], index, 0 });
+      if (operands[1] != nullptr)
+        stack.push_back({ operands[1], index, 1 });
+    }
+    uint32_t last = nodes.size() - 1;
+    std::reverse(nodes.begin(), nodes.end());
+    std::reverse(exprs.begin(), exprs.end());
+    for (FlatNode &n : nodes)
+    {
+      if (n.left != none)
+        n.left = last - n.left;
+      if (n.right != none)
+        n.right = last - n.right;
+    }
+    f.nodes.assign(nodes.begin(), nodes.end());
+    f.exprs.assign(exprs.begin(), exprs.end());
+  }
+};
+
 class IntConst : public Expr
 {
 public:
@@ -393,14 +1560,96 @@ public:
     return num;
   }
 
+  virtual FlatKind get_flat_node(Expr *operands[2], char &op, int &value) const override
+  {
+    value = num;
+    return FlatKind::IntConst;
+  }
+
+  virtual bool fold(int &value) override
+  {
+    value = num;
+    return true;
+  }
+
+  virtual bool get_constant(int &value) const override
+  {
+    value = num;
+    return true;
+  }
+
+  virtual llvm::Value *codegen() override
+  {
+    return c32(num);
+  }
+
+  virtual int lower_value(BytecodeBuilder &B) override
+  {
+    int r = B.reg();
+    B.emit(Op::CONST, r, num);
+    return r;
+  }
+
+  virtual void sem() override
+  {
+    type = DataType::TYPE_int;
+  }
+
+  virtual bool is_rvalue() const override
+  {
+    return true;
+  }
+
+private:
+  int num;
+};
+
+class CharConst : public Expr
+{
+public:
+  CharConst(char c, int lineno = 0) : charval(c) { line_number = lineno; }
+  virtual void printOn(std::ostream &out) const override
+  {
+    out << "CharConst(" << charval << ")";
+  }
+  virtual int eval() const override
+  {
+    return charval;
+  }
+
+  virtual FlatKind get_flat_node(Expr *operands[2], char &op, int &value) const override
+  {
+    value = charval;
+    return FlatKind::CharConst;
+  }
+
+  virtual bool fold(int &value) override
+  {
+    value = charval;
+    return true;
+  }
+
+  virtual bool get_constant(int &value) const override
+  {
+    value = charval;
+    return true;
+  }
+
+  virtual void sem() override
+  {
+    type = DataType::TYPE_char;
+  }
+
   virtual llvm::Value *codegen() override
   {
-    return c32(num);
+    return c8(charval);
   }
 
-  virtual void sem() override
+  virtual int lower_value(BytecodeBuilder &B) override
   {
-    type = DataType::TYPE_int;
+    int r = B.reg();
+    B.emit(Op::CONST, r, charval);
+    return r;
   }
 
   virtual bool is_rvalue() const override
@@ -409,30 +1658,70 @@ public:
   }
 
 private:
-  int num;
+  char charval;
 };
 
-class CharConst : public Expr
+/*
+* A condition that the fold pass found constant. The language has no
+* literal for it, so only the fold pass makes them.
+*/
+class BoolConst : public Expr
 {
 public:
-  CharConst(char c, int lineno = 0) : charval(c) { line_number = lineno; }
+  BoolConst(bool b, int lineno = 0) : boolval(b) { line_number = lineno; }
   virtual void printOn(std::ostream &out) const override
   {
-    out << "CharConst(" << charval << ")";
+    out << "BoolConst(" << (boolval ? "true" : "false") << ")";
   }
   virtual int eval() const override
   {
-    return charval;
+    return boolval;
+  }
+
+  virtual FlatKind get_flat_node(Expr *operands[2], char &op, int &value) const override
+  {
+    value = boolval;
+    return FlatKind::BoolConst;
+  }
+
+  virtual bool fold(int &value) override
+  {
+    value = boolval;
+    return true;
+  }
+
+  virtual bool get_constant(int &value) const override
+  {
+    value = boolval;
+    return true;
+  }
+
+  virtual bool is_condition() const override
+  {
+    return true;
   }
 
   virtual void sem() override
   {
-    type = DataType::TYPE_char;
+    type = DataType::TYPE_int;
   }
 
   virtual llvm::Value *codegen() override
   {
-    return c8(charval);
+    return c1(boolval);
+  }
+
+  virtual int lower_value(BytecodeBuilder &B) override
+  {
+    int r = B.reg();
+    B.emit(Op::CONST, r, boolval);
+    return r;
+  }
+
+  virtual void lower_branch(BytecodeBuilder &B, bool when, int label) override
+  {
+    if (boolval == when)
+      B.emit_jump(Op::JMP, label);
   }
 
   virtual bool is_rvalue() const override
@@ -441,17 +1730,33 @@ public:
   }
 
 private:
-  char charval;
+  bool boolval;
 };
 
+inline Expr *Expr::folded(Expr *e)
+{
+  int value;
+  if (!e->fold(value) || e->get_constant(value))
+    return e;
+  Expr *constant;
+  if (e->is_condition())
+    constant = new BoolConst(value, e->line_number);
+  else if (e->get_type() == DataType::TYPE_char)
+    constant = new CharConst(value, e->line_number);
+  else
+    constant = new IntConst(value, e->line_number);
+  constant->sem();
+  return constant;
+}
+
 class Id : public Expr
 {
 public:
-  Id(std::string *s, int lineno = 0) : var(s) { line_number = lineno; }
+  Id(Atom s, int lineno = 0) : var(s) { line_number = lineno; }
 
   void printOn(std::ostream &out) const override
   {
-    out << "Id(" << *var << ")";
+    out << "Id(" << atoms.name(var) << ")";
   }
   // TODO: implement
   virtual int eval() const override
@@ -462,27 +1767,26 @@ public:
   virtual void sem() override
   {
     // std::cout<<"looking up "<<*var<<std::endl;
-    STEntry *entry = st.lookup(*var);
+    entry = st.lookup(var);
     if (entry == nullptr)
     {
       yyerror2("Variable not declared", line_number);
     }
     // std::cout<<"entry kind: " << entry->kind << std::endl;
-    if (!entry->dimensions.empty())
-    {
-      dimensions = entry->dimensions;
-    }
+    shape = entry->shape;
     if (entry->missingFirstDimension)
     {
-      dimensions.insert(dimensions.begin(), 0);
+      shape = types.unknown_first(shape);
     }
     type = entry->type;
     kind = entry->kind;
+    if (kind != EntryKind::FUNCTION && !st.is_local(entry))
+      st.set_impure();
   }
 
   virtual llvm::Value *llvm_get_array_offset(std::vector<llvm::Value *> *indices) override {
-    std::string current_function_name = std::string(Builder.GetInsertBlock()->getParent()->getName());
-    llvm::Value *alloca = NamedValues[current_function_name][get_translation_real_to_local(*var)];
+    Atom current_function_name = current_function();
+    llvm::Value *alloca = NamedValues[current_function_name][get_translation_real_to_local(var)];
     if (!alloca) //this won't happen because we check for undeclared variables in sem
     {
       yyerror2("Unknown variable name", line_number);
@@ -492,14 +1796,14 @@ public:
 
   virtual llvm::Value *llvm_get_value_ptr(bool isParam = false) override
   {
-    std::string current_function_name = std::string(Builder.GetInsertBlock()->getParent()->getName());
-    std::string translation = get_translation_real_to_local(*var);
+    Atom current_function_name = current_function();
+    Atom translation = get_translation_real_to_local(var);
     // AST::logToFile("looking up " + translation + " in " + current_function_name);
     llvm::Value *alloca = NamedValues[current_function_name][translation];
-    if(NamedValues[current_function_name][*var]) {
+    if(NamedValues[current_function_name][var]) {
       // AST::logToFile("translation for var exists");
       // AST::logToFile("translation: " + NamedValues[current_function_name][*var]->getName().str());
-      alloca = NamedValues[current_function_name][*var];
+      alloca = NamedValues[current_function_name][var];
     }
     if (!alloca) //this won't happen because we check for undeclared variables in sem
     {
@@ -508,7 +1812,7 @@ public:
     // TODO: check if this is correct
     if(alloca->getType()->isPointerTy() && alloca->getType()->getPointerElementType()->isPointerTy()) {
       llvm::Value *ptr = Builder.CreateGEP(alloca, c32(0), "outptr");
-      return Builder.CreateLoad(ptr, *var);
+      return Builder.CreateLoad(ptr, atoms.name(var));
     }
     if(alloca->getType()->isPointerTy() && alloca->getType()->getPointerElementType()->isArrayTy()) {
       llvm::Value *ptr = Builder.CreateGEP(alloca, c32(0), "firstelementptr");
@@ -519,8 +1823,8 @@ public:
   }
 
   virtual llvm::Type *get_llvm_type() override {
-    std::string current_function_name = std::string(Builder.GetInsertBlock()->getParent()->getName());
-    llvm::Value *alloca = NamedValues[current_function_name][*var];
+    Atom current_function_name = current_function();
+    llvm::Value *alloca = NamedValues[current_function_name][var];
     if (!alloca) //this won't happen because we check for undeclared variables in sem
     {
       yyerror2("Unknown variable name", line_number);
@@ -530,30 +1834,139 @@ public:
 
   virtual llvm::Value *codegen() override
   {
-    std::string current_function_name = std::string(Builder.GetInsertBlock()->getParent()->getName());
-    llvm::Value *alloca = NamedValues[current_function_name][get_translation_real_to_local(*var)];
+    Atom current_function_name = current_function();
+    llvm::Value *alloca = NamedValues[current_function_name][get_translation_real_to_local(var)];
     if (!alloca) //this won't happen because we check for undeclared variables in sem
     {
       yyerror2("Unknown variable name", line_number);
     }
      if(alloca->getType()->isPointerTy() && alloca->getType()->getPointerElementType()->isPointerTy()) {
       llvm::Value *outptr = Builder.CreateGEP(alloca, c32(0), "outptr");
-      llvm::Value *inptr = Builder.CreateLoad(outptr, *var);
-      return Builder.CreateLoad(inptr, *var);
+      llvm::Value *inptr = Builder.CreateLoad(outptr, atoms.name(var));
+      return Builder.CreateLoad(inptr, atoms.name(var));
     }
     llvm::Value *ptr = Builder.CreateGEP(alloca, c32(0), "ptr");
-    return Builder.CreateLoad(ptr, *var);
+    return Builder.CreateLoad(ptr, atoms.name(var));
+  }
+
+  virtual int lower_address(BytecodeBuilder &B) override
+  {
+    BytecodeBuilder::Variable v = B.lookup_variable(var);
+    int r = B.reg();
+    if (v.hops == 0) {
+      B.emit(v.reference ? Op::LOADL32 : Op::FRAME, r, v.offset);
+      return r;
+    }
+    B.emit(Op::ADDRUP, r, v.hops, v.offset);
+    if (v.reference)
+      B.emit(Op::LOAD32, r, r);
+    return r;
+  }
+
+  virtual int lower_value(BytecodeBuilder &B) override
+  {
+    if (!shape->is_scalar())
+      return lower_address(B);
+    BytecodeBuilder::Variable v = B.lookup_variable(var);
+    if (v.hops == 0 && !v.reference) {
+      int r = B.reg();
+      B.emit(v.size == 1 ? Op::LOADL8 : Op::LOADL32, r, v.offset);
+      return r;
+    }
+    int r = lower_address(B);
+    B.emit(v.size == 1 ? Op::LOAD8 : Op::LOAD32, r, r);
+    return r;
+  }
+
+  virtual void lower_store(BytecodeBuilder &B, Expr *value) override
+  {
+    BytecodeBuilder::Variable v = B.lookup_variable(var);
+    if (v.hops != 0 || v.reference) {
+      Expr::lower_store(B, value);
+      return;
+    }
+    int r = value->lower_value(B);
+    B.emit(v.size == 1 ? Op::STOREL8 : Op::STOREL32, v.offset, r);
+  }
+
+  // the entry stays in the symbol table until the function is folded
+  STEntry *get_entry() const
+  {
+    return entry;
+  }
+
+  virtual bool fold(int &value) override
+  {
+    if (!entry->constant)
+      return false;
+    value = entry->value;
+    return true;
+  }
+
+  virtual Interval range(const RangeEnv &env) override
+  {
+    return is_tracked() ? env.get(entry) : Interval::all();
+  }
+
+  virtual void narrow(RangeEnv &env, char op, Interval bound) override
+  {
+    if (!is_tracked())
+      return;
+    Interval r = env.get(entry);
+    switch (op)
+    {
+    case '<': r.hi = std::min(r.hi, bound.hi - 1); break;
+    case 'l': r.hi = std::min(r.hi, bound.hi); break;
+    case '>': r.lo = std::max(r.lo, bound.lo + 1); break;
+    case 'g': r.lo = std::max(r.lo, bound.lo); break;
+    case '=':
+      r.lo = std::max(r.lo, bound.lo);
+      r.hi = std::min(r.hi, bound.hi);
+      break;
+    case '#':
+      if (bound.lo == bound.hi && r.lo == bound.lo)
+        r.lo++;
+      else if (bound.lo == bound.hi && r.hi == bound.hi)
+        r.hi--;
+      break;
+    }
+    env.set(entry, r);
+  }
+
+  // the value of an assignment to it
+  void assign_range(RangeEnv &env, Interval value)
+  {
+    if (is_tracked())
+      env.set(entry, value);
+  }
+
+  virtual llvm::Value *codegen_first_dimension() override
+  {
+    if (shape->dimensions[0] != 0)
+      return Expr::codegen_first_dimension();
+    llvm::Value *alloca = NamedValues[current_function()][get_translation_real_to_local(size_atom(var))];
+    // the functions nested in the one of the array get a pointer to its size
+    if (alloca->getType()->getPointerElementType()->isPointerTy())
+      alloca = Builder.CreateLoad(alloca, "sizeptr");
+    return Builder.CreateLoad(alloca, "size");
   }
 
 private:
-  std::string *var;
+  Atom var;
+  STEntry *entry = nullptr;
+
+  // the int variables the range analysis follows: the ones only their own function assigns
+  bool is_tracked() const
+  {
+    return entry->kind != EntryKind::FUNCTION && type == DataType::TYPE_int && shape->is_scalar() &&
+           entry->passingType == PassingType::BY_VALUE && !entry->escapes && st.is_local(entry);
+  }
 };
 
 class StringLiteral : public Expr
 {
 public:
-  StringLiteral(std::string *s, int lineno = 0) : stringval(s) { line_number = lineno; }
-  ~StringLiteral() { delete stringval; }
+  StringLiteral(ArenaString *s, int lineno = 0) : stringval(s) { line_number = lineno; }
 
   void printOn(std::ostream &out) const override
   {
@@ -569,35 +1982,35 @@ public:
   virtual void sem() override
   {
     type = DataType::TYPE_char;
-    dimensions.push_back(stringval->length() + 1);
+    shape = types.shape(std::vector<int>(1, stringval->length() + 1));
   }
 
   virtual llvm::Value *codegen() override
   {
-    llvm::Value *string_ptr = Builder.CreateGlobalString(*stringval, "string");
-    return Builder.CreateGEP(string_ptr, std::vector<llvm::Value *>({c32(0), c32(0)}), "stringptr");
+    return string_constant(llvm::StringRef(stringval->data(), stringval->size()));
     // return Builder.CreateLoad(string_ptr, "stringliteral");
   }
 
   virtual llvm::Value *llvm_get_value_ptr(bool isParam = false) override
   {
-    llvm::Value *string_ptr = Builder.CreateGlobalString(*stringval, "string");
-    return Builder.CreateGEP(string_ptr, std::vector<llvm::Value *>({c32(0), c32(0)}), "stringptr");
+    return string_constant(llvm::StringRef(stringval->data(), stringval->size()));
+  }
+
+  virtual int lower_value(BytecodeBuilder &B) override
+  {
+    int r = B.reg();
+    B.emit(Op::CONST, r, B.string_constant(std::string(stringval->data(), stringval->size())));
+    return r;
   }
 
 private:
-  std::string *stringval;
+  ArenaString *stringval;
 };
 
 class ArrayAccess : public Expr
 {
 public:
   ArrayAccess(Expr *obj, Expr *pos) : object(obj), position(pos) { line_number = obj->line_number; }
-  ~ArrayAccess()
-  {
-    delete object;
-    delete position;
-  }
 
   void printOn(std::ostream &out) const override
   {
@@ -608,7 +2021,7 @@ public:
   {
     std::vector<llvm::Value *> *indices = new std::vector<llvm::Value *>();
     llvm::Value *base = object->llvm_get_array_offset(indices);
-    indices->push_back(position->codegen());
+    indices->push_back(codegen_index());
     unsigned long int count = 1;
     llvm::Type *type = base->getType()->getPointerElementType();
     while (type->isArrayTy())
@@ -646,18 +2059,26 @@ public:
       yyerror2("Cannot index with a function", line_number);
     }
     position->type_check(DataType::TYPE_int); // maybe not needed
-    if (object->get_dimensions().empty())
+    if (object->get_shape()->is_scalar())
     {
       yyerror2("Cannot index a non-array", line_number);
     }
     type = object->get_type();
-    dimensions = object->get_dimensions();
-    dimensions.erase(dimensions.begin());
+    shape = types.element(object->get_shape());
+  }
+
+  // only the index can be folded, the array is a variable
+  virtual bool fold(int &value) override
+  {
+    int v;
+    object->fold(v);
+    position = folded(position);
+    return false;
   }
 
   virtual llvm::Value *llvm_get_array_offset(std::vector<llvm::Value *> *indices) {
     llvm::Value *result = object->llvm_get_array_offset(indices);
-    indices->push_back(position->codegen());
+    indices->push_back(codegen_index());
     return result;
   }
 
@@ -669,7 +2090,7 @@ public:
     //std::cout << std::endl << "base: " ;
     //base->print(llvm::outs());
     //std::cout << std::endl;
-    indices->push_back(position->codegen());
+    indices->push_back(codegen_index());
     if(base->getType()->isPointerTy() && base->getType()->getPointerElementType()->isPointerTy())
       base = Builder.CreateLoad(base, "array"); //this is dumb, it loads the whole array, oh well
     llvm::Value *ptr = Builder.CreateGEP(base, *indices, "elementptr");
@@ -677,24 +2098,87 @@ public:
     return Builder.CreateLoad(ptr, "element");
   }
 
+  virtual Interval range(const RangeEnv &env) override
+  {
+    object->range(env);
+    Interval index = position->range(env);
+    if (env.reachable)
+    {
+      int size = object->get_shape()->dimensions[0];
+      analyzed = true;
+      if (size == 0 || !index.within(0, size - 1))
+        in_bounds = false;
+    }
+    return Interval::all();
+  }
+
+  virtual int lower_address(BytecodeBuilder &B) override
+  {
+    int base = object->lower_address(B);
+    // the size of what this index steps over
+    int stride = byte_size(type);
+    for (int d : shape->dimensions)
+      stride *= d;
+    int r = B.reg();
+    if (IntConst *constant = dynamic_cast<IntConst *>(position)) {
+      B.emit(Op::ADDI, r, base, constant->get_int_cosnt_number() * stride);
+      return r;
+    }
+    int index = position->lower_value(B);
+    if (stride != 1) {
+      B.emit(Op::MULI, r, index, stride);
+      index = r;
+    }
+    B.emit(Op::ADD, r, base, index);
+    return r;
+  }
+
+  virtual int lower_value(BytecodeBuilder &B) override
+  {
+    int r = lower_address(B);
+    if (shape->is_scalar())
+      B.emit(type == DataType::TYPE_char ? Op::LOAD8 : Op::LOAD32, r, r);
+    return r;
+  }
+
 private:
   Expr *object;
   Expr *position;
+  // whether the range analysis got to the access, and found its index in bounds every time
+  bool analyzed = false;
+  bool in_bounds = true;
+
+  /*
+  * The index, which -fbounds-check compares with the first dimension of
+  * the array, unless the range analysis proved that it is in bounds. An
+  * index out of them ends the program with a runtime error.
+  */
+  llvm::Value *codegen_index()
+  {
+    llvm::Value *index = position->codegen();
+    if (!bounds_check || (analyzed && in_bounds))
+      return index;
+    llvm::Value *check = Builder.CreateICmpULT(index, object->codegen_first_dimension(), "inbounds");
+    llvm::Function *TheFunction = Builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock *FailBB = llvm::BasicBlock::Create(TheContext, "outofbounds", TheFunction);
+    llvm::BasicBlock *ContBB = llvm::BasicBlock::Create(TheContext, "boundscont", TheFunction);
+    Builder.CreateCondBr(check, ContBB, FailBB);
+    Builder.SetInsertPoint(FailBB);
+    Builder.CreateCall(bounds_error_function(), { c32(line_number) });
+    Builder.CreateUnreachable();
+    Builder.SetInsertPoint(ContBB);
+    return index;
+  }
 };
 
 class ExpressionList : public Expr
 {
 public:
-  std::vector<Expr *> expressions;
+  ArenaVector<Expr *> expressions;
 
   ExpressionList(Expr *e) : expressions() { expressions.push_back(e); }
-  ~ExpressionList()
-  {
-    for (Expr *e : expressions)
-      delete e;
-  }
 
-  void add_expression(Expr *e) { expressions.insert(expressions.begin(), e); }
+  void add_expression(Expr *e) { expressions.push_back(e); }
   void printOn(std::ostream &out) const override
   {
     out << "ExpressionList(";
@@ -727,25 +2211,45 @@ public:
   {
     return nullptr;
   }
+
+  // the expressions are lowered by the call they are the arguments of
+  virtual int lower_value(BytecodeBuilder &B) override
+  {
+    return -1;
+  }
 };
 
-class FunctionCall : public Expr, public Stmt
+class EmptyStmt : public Stmt
 {
 public:
-  FunctionCall(std::string *i, ExpressionList *el = nullptr, int lineno = 0) : id(i), args(el)
+  EmptyStmt() {}
+  void printOn(std::ostream &out) const override
   {
-    line_number = lineno;
+    out << "EmptyStmt()";
   }
-  FunctionCall(std::string *i, int lineno = 0) : id(i) { line_number = lineno; }
-  ~FunctionCall()
+  void run() const override {}
+
+  virtual void sem() override {} // idk if this is needed
+
+  virtual llvm::Value *codegen() override {
+    return nullptr;
+  }
+
+  virtual void lower(BytecodeBuilder &B) override {}
+};
+
+class FunctionCall : public Expr, public Stmt
+{
+public:
+  FunctionCall(Atom i, ExpressionList *el = nullptr, int lineno = 0) : id(i), args(el)
   {
-    delete id;
-    delete args;
+    line_number = lineno;
   }
+  FunctionCall(Atom i, int lineno = 0) : id(i), args(nullptr) { line_number = lineno; }
 
   void printOn(std::ostream &out) const override
   {
-    out << "FunctionCall(" << *id;
+    out << "FunctionCall(" << atoms.name(id);
     if (args != nullptr)
       out << ", " << *args;
     out << ")";
@@ -769,24 +2273,12 @@ public:
   }
 
   bool is_library_function () {
-    return strcmp(id->c_str(), "writeInteger") == 0 ||
-           strcmp(id->c_str(), "writeString") == 0 ||
-           strcmp(id->c_str(), "writeChar") == 0 ||
-           strcmp(id->c_str(), "readInteger") == 0 ||
-           strcmp(id->c_str(), "readString") == 0 ||
-           strcmp(id->c_str(), "readChar") == 0 ||
-           strcmp(id->c_str(), "ord") == 0 ||
-           strcmp(id->c_str(), "ascii") == 0 ||
-           strcmp(id->c_str(), "chr") == 0 ||
-           strcmp(id->c_str(), "strlen") == 0 ||
-           strcmp(id->c_str(), "strcmp") == 0 ||
-           strcmp(id->c_str(), "strcpy") == 0 ||
-           strcmp(id->c_str(), "strcat") == 0;
+    return AtomTable::is_library(id);
   }
 
   virtual void sem() override
   {
-    STEntry *entry = st.lookup(*id);
+    STEntry *entry = st.lookup(id);
     if (entry == nullptr)
     {
       yyerror2("Function not declared", line_number);
@@ -796,32 +2288,47 @@ public:
       yyerror2("Not a function", line_number);
     }
     type = entry->type;
+    signature = entry->signature;
+    LibraryFunction f;
+    if (BytecodeBuilder::get_library_function(id, f)) {
+      if (!VM::library_is_pure(f))
+        st.set_impure();
+    }
+    else {
+      st.add_call(entry);
+      evaluator_index = entry->evaluator_index;
+    }
     if (args == nullptr)
     {
-      if (!entry->paramTypes.empty())
+      if (!entry->signature->params.empty())
       {
         yyerror2("No arguments provided", line_number);
       }
     }
     else
     {
-      if (entry->paramTypes.size() != args->expressions.size())
+      if (entry->signature->params.size() != args->expressions.size())
       {
         yyerror2("Wrong number of arguments", line_number);
       }
-      std::vector<std::tuple<DataType, PassingType, std::vector<int>, bool>>::iterator param_it = entry->paramTypes.begin();
+      std::vector<Param>::const_iterator param_it = entry->signature->params.begin();
       for (const auto &e : args->expressions)
       {
         e->sem();
-        if(std::get<1>(*param_it) == PassingType::BY_REFERENCE) {
+        if(param_it->passing_type == PassingType::BY_REFERENCE) {
           if(e->is_rvalue() == true) {
             yyerror2("Cannot pass r-value by reference", line_number);
           }
+          // the callee may assign it
+          if (Id *id = dynamic_cast<Id *>(e)) {
+            id->get_entry()->assignments++;
+            id->get_entry()->escapes = true;
+          }
         }
-        std::vector<int> param_dimensions = std::get<2>(*param_it); // copy dimensions vector
-        if (std::get<3>(*param_it)) // if missing first dimension
-          param_dimensions.insert(param_dimensions.begin(), 0);
-        e->type_check(std::get<0>(*param_it), param_dimensions);
+        const Shape *param_shape = param_it->shape;
+        if (param_it->missing_first_dimension)
+          param_shape = types.unknown_first(param_shape);
+        e->type_check(param_it->type, param_shape);
         ++param_it;
       }
     }
@@ -829,11 +2336,19 @@ public:
 
   virtual llvm::Value *codegen() override
   {
-    std::string callee_function_name = std::string("user_") + *id;
+    // ascii and chr only convert between chars and ints, like ord and chr of lib.a do
+    LibraryFunction f;
+    if(BytecodeBuilder::get_library_function(id, f) && (f == LibraryFunction::ascii || f == LibraryFunction::chr)) {
+      llvm::Value *arg = args->expressions[0]->codegen();
+      if(f == LibraryFunction::ascii)
+        return Builder.CreateZExt(arg, i32, "ascii");
+      return Builder.CreateTrunc(arg, i8, "chr");
+    }
+    Atom callee_function_name = atoms.user(id);
     if(this->is_library_function()) {
-      callee_function_name = *id;
+      callee_function_name = id;
     }
-    llvm::Function *CalleeF = TheModule->getFunction(callee_function_name);
+    llvm::Function *CalleeF = TheModule->getFunction(atoms.name(callee_function_name));
     // llvm::Function *CalleeF = NamedFunctions[*id];
     if(!CalleeF) {
       yyerror2("Unknown function referenced", line_number);
@@ -846,7 +2361,15 @@ public:
     if(args != nullptr) {
       user_param_count = args->expressions.size();
     }
-    std::string caller_function_name = std::string(Builder.GetInsertBlock()->getParent()->getName());
+    Atom caller_function_name = current_function();
+    // and after the arguments, the first dimensions of the arrays of unknown size
+    std::vector<llvm::Value *> sizes;
+    if(bounds_check && !this->is_library_function()) {
+      for(unsigned i = 0; i < user_param_count; i++) {
+        if(signature->params[i].missing_first_dimension)
+          sizes.push_back(args->expressions[i]->codegen_first_dimension());
+      }
+    }
 
     // std::map<std::string, llvm::Value *>::iterator it = NamedValues.begin();
     // Expr::logToFile("calling: " + callee_function_name + " from: " + caller_function_name);
@@ -854,19 +2377,24 @@ public:
     // Expr::logToFile("signature arg count: " + std::to_string(CalleeF->arg_size()));
 
     for(unsigned i = 0, e = CalleeF->arg_size(); i != e; ++i) {
+      if(i >= user_param_count && i < user_param_count + sizes.size()) {
+        ArgV.push_back(sizes[i - user_param_count]);
+        ++argIt;
+        continue;
+      }
       if(i >= user_param_count) { /* local variables */
-        std::string param_name = std::string(argIt->getName());
+        Atom param_name = name_atom(&*argIt);
         // Expr::logToFile("param_name: " + param_name);
         // Expr::logToFile("callee_function_name: " + callee_function_name);
-        std::map<std::string, std::string> *CalleeFunctionLocalToRealTranslations = FunctionTranslationTablesLocalToReal[callee_function_name];
+        std::map<Atom, Atom> *CalleeFunctionLocalToRealTranslations = FunctionTranslationTablesLocalToReal[callee_function_name];
         if(CalleeFunctionLocalToRealTranslations == nullptr) {
           // Expr::logToFile("CalleeFunctionLocalToRealTranslations is null");
         }
         // Expr::logToFile("looking up: " + param_name + " in local to real of " + callee_function_name);
-        std::string real_param_name = (*CalleeFunctionLocalToRealTranslations)[param_name];
+        Atom real_param_name = (*CalleeFunctionLocalToRealTranslations)[param_name];
         // Expr::logToFile("real_param_name: " + real_param_name);
-        std::map<std::string, std::string> *CallerFunctionRealToLocalTranslations = FunctionTranslationTablesRealToLocal[caller_function_name];
-        std::string local_param_name = (*CallerFunctionRealToLocalTranslations)[real_param_name];
+        std::map<Atom, Atom> *CallerFunctionRealToLocalTranslations = FunctionTranslationTablesRealToLocal[caller_function_name];
+        Atom local_param_name = (*CallerFunctionRealToLocalTranslations)[real_param_name];
         // Expr::logToFile("local param: " + local_param_name + " real param: " + real_param_name + " param name " + param_name);
         llvm::Value *arg_value = NamedValues[caller_function_name][local_param_name];
         // std::cout << "local param: " << local_param_name << " real param: " << real_param_name << " param name " << param_name << std::endl;
@@ -874,7 +2402,7 @@ public:
         if(arg_value->getType()->isPointerTy()) {
           if(arg_value->getType()->getPointerElementType()->isPointerTy()) {
             llvm::Value *ptr = Builder.CreateGEP(arg_value, c32(0), "ptrtolocal");
-            ArgV.push_back(Builder.CreateLoad(ptr, param_name));
+            ArgV.push_back(Builder.CreateLoad(ptr, atoms.name(param_name)));
           }
           else {
             ArgV.push_back(arg_value);
@@ -905,16 +2433,128 @@ public:
     return Builder.CreateCall(CalleeF, ArgV);
   }
 
+  virtual int lower_value(BytecodeBuilder &B) override
+  {
+    LibraryFunction f;
+    if (B.get_library_function(id, f)) {
+      // the only arrays the library takes are strings, by reference
+      std::vector<bool> by_reference;
+      if (args != nullptr)
+        for (const auto &e : args->expressions)
+          by_reference.push_back(!e->get_shape()->is_scalar());
+      int base = lower_arguments(B, by_reference);
+      int r = B.reg();
+      B.emit(Op::LIB, r, int(f), base);
+      return r;
+    }
+    int index = B.lookup_function(id);
+    int base = lower_arguments(B, B.get_function(index).by_reference);
+    int r = B.reg();
+    B.emit(Op::CALL, r, index, base);
+    return r;
+  }
+
+  virtual void lower(BytecodeBuilder &B) override
+  {
+    lower_value(B);
+  }
+
+  /*
+  * The arguments passed by value can be folded to constants, and then
+  * a call of a pure function gets evaluated
+  */
+  virtual bool fold(int &value) override
+  {
+    if (args != nullptr)
+    {
+      for (unsigned i = 0; i < args->expressions.size(); i++)
+      {
+        Expr *&e = args->expressions[i];
+        if (signature->params[i].passing_type == PassingType::BY_VALUE)
+          e = folded(e);
+        else
+          e->fold(value);
+      }
+    }
+    return type != DataType::TYPE_nothing && evaluate(value);
+  }
+
+  // a call of a pure function that completes does nothing else
+  virtual Stmt *fold(bool unconditional) override
+  {
+    int value;
+    if (fold(value) || (type == DataType::TYPE_nothing && evaluate(value)))
+      return new EmptyStmt();
+    return this;
+  }
+
+  virtual Interval range(const RangeEnv &env) override
+  {
+    if (args != nullptr)
+      for (Expr *e : args->expressions)
+        e->range(env);
+    return Interval::all();
+  }
+
+  // a call can't assign the variables in env
+  virtual void range(RangeEnv &env) override
+  {
+    const RangeEnv &values = env;
+    range(values);
+  }
+
 private:
-  std::string *id;
+  Atom id;
   ExpressionList *args;
+  const Signature *signature = nullptr;
+  int evaluator_index = -1;
+
+  bool evaluate(int &value)
+  {
+    if (evaluator_index < 0)
+      return false;
+    std::vector<int32_t> values;
+    if (args != nullptr)
+    {
+      for (Expr *e : args->expressions)
+      {
+        int v;
+        if (!e->get_constant(v))
+          return false;
+        values.push_back(v);
+      }
+    }
+    return evaluator.call(evaluator_index, values, value);
+  }
+
+  /*
+  * Leaves the arguments in consecutive registers
+  * and returns the first one
+  */
+  int lower_arguments(BytecodeBuilder &B, std::vector<bool> by_reference)
+  {
+    if (args == nullptr)
+      return B.mark();
+    std::vector<int> values;
+    bool consecutive = true;
+    for (unsigned i = 0; i < args->expressions.size(); i++) {
+      Expr *e = args->expressions[i];
+      values.push_back(by_reference[i] ? e->lower_address(B) : e->lower_value(B));
+      consecutive = consecutive && values[i] == values[0] + int(i);
+    }
+    if (consecutive)
+      return values[0];
+    int base = B.mark();
+    for (int value : values)
+      B.emit(Op::MOV, B.reg(), value);
+    return base;
+  }
 };
 
-class Negative : public Expr
+class Negative : public Operator
 {
 public:
   Negative(Expr *e) : expr(e) { line_number = e->line_number; }
-  ~Negative() { delete expr; }
   virtual void printOn(std::ostream &out) const override
   {
     out << "Negative(" << *expr << ")";
@@ -924,41 +2564,20 @@ public:
     return -(expr->eval());
   }
 
-  virtual bool is_rvalue() const override
-  {
-    return true;
-  }
-
-  virtual void sem() override
+  virtual FlatKind get_flat_node(Expr *operands[2], char &op, int &value) const override
   {
-    expr->sem();
-    type = expr->get_type();
-    dimensions = expr->get_dimensions();
-    if (expr->get_kind() == EntryKind::FUNCTION)
-    {
-      yyerror2("Cannot negate a function", line_number);
-    }
-  }
-
-  virtual llvm::Value *codegen() override {
-    llvm::Value *V = expr->codegen();
-    if(!V) return nullptr;
-    return Builder.CreateNeg(V, "negtmp");
+    operands[0] = expr;
+    return FlatKind::Negative;
   }
 
 private:
   Expr *expr;
 };
 
-class BinOp : public Expr
+class BinOp : public Operator
 {
 public:
   BinOp(Expr *l, char o, Expr *r) : left(l), op(o), right(r) { line_number = l->line_number; }
-  ~BinOp()
-  {
-    delete left;
-    delete right;
-  }
 
   virtual void printOn(std::ostream &out) const override
   {
@@ -1000,15 +2619,26 @@ public:
     return 0; // this will never be reached
   }
 
-  virtual bool is_rvalue() const override
+  // the short-circuit operators are leaves of the flattened trees
+  virtual FlatKind get_flat_node(Expr *operands[2], char &o, int &value) const override
   {
-    return true;
+    if (is_short_circuit())
+      return FlatKind::Leaf;
+    operands[0] = left;
+    operands[1] = right;
+    o = op;
+    return FlatKind::BinOp;
   }
 
   // TODO: maybe check to see if operands are ints only
   // otherwise we allow char operations
   virtual void sem() override
   {
+    if (!is_short_circuit())
+    {
+      Operator::sem();
+      return;
+    }
     left->sem();
     right->sem();
     if (left->get_kind() == EntryKind::FUNCTION)
@@ -1019,52 +2649,12 @@ public:
     {
       yyerror2("right operand cannot be a function", line_number);
     }
-    left->type_check(right->get_type(), right->get_dimensions());
+    left->type_check(right->get_type(), right->get_shape());
     type = left->get_type();
-    if (left->get_dimensions().empty() || left->get_dimensions().front() == 0)
-      dimensions = right->get_dimensions();
+    if (left->get_shape()->is_scalar() || left->get_dimensions().front() == 0)
+      shape = right->get_shape();
     else
-      dimensions = left->get_dimensions();
-  }
-
-  //for non short-cirtuiting binary operators
-  virtual llvm::Value *binop_basic_codegen() {
-    llvm::Value *l = left->codegen();
-    while(l->getType()->isPointerTy()) {
-      llvm::Value *tmp = Builder.CreateGEP(l, c32(0));
-      l = Builder.CreateLoad(tmp);
-    }
-    llvm::Value *r = right->codegen();
-    while(r->getType()->isPointerTy()) {
-      llvm::Value *tmp = Builder.CreateGEP(r, c32(0));
-      r = Builder.CreateLoad(tmp);
-    }
-    switch (op)
-    {
-    case '+':
-      return Builder.CreateAdd(l, r, "addtmp");
-    case '-':
-      return Builder.CreateSub(l, r, "subtmp");
-    case '*':
-      return Builder.CreateMul(l, r, "multmp");
-    case '/':
-      return Builder.CreateSDiv(l, r, "divtmp");
-    case '%':
-      return Builder.CreateSRem(l, r, "modtmp");
-    case '=':
-      return Builder.CreateICmpEQ(l, r, "eqtmp");
-    case '#':
-      return Builder.CreateICmpNE(l, r, "netmp");
-    case '<':
-      return Builder.CreateICmpSLT(l, r, "lttmp");
-    case '>':
-      return Builder.CreateICmpSGT(l, r, "gttmp");
-    case 'l':
-      return Builder.CreateICmpSLE(l, r, "letmp");
-    case 'g':
-      return Builder.CreateICmpSGE(l, r, "getmp");
-    }
-    return nullptr;
+      shape = left->get_shape();
   }
 
   virtual llvm::Value *codegen() override
@@ -1152,22 +2742,120 @@ public:
         return PN;
       }
     default:
-      return binop_basic_codegen();
+      return Operator::codegen();
+    }
+    return nullptr;
+  }
+
+  virtual int lower_value(BytecodeBuilder &B) override
+  {
+    if (op == '&' || op == '|') {
+      int r = B.reg();
+      int is_false = B.new_label(), end = B.new_label();
+      lower_branch(B, false, is_false);
+      B.emit(Op::CONST, r, 1);
+      B.emit_jump(Op::JMP, end);
+      B.bind(is_false);
+      B.emit(Op::CONST, r, 0);
+      B.bind(end);
+      return r;
+    }
+    return Operator::lower_value(B);
+  }
+
+  virtual void lower_branch(BytecodeBuilder &B, bool when, int label) override
+  {
+    if (op == '&' || op == '|') {
+      // jump on the first operand that decides it, fall through otherwise
+      if ((op == '&') != when) {
+        left->lower_branch(B, when, label);
+        right->lower_branch(B, when, label);
+      } else {
+        int skip = B.new_label();
+        left->lower_branch(B, !when, skip);
+        right->lower_branch(B, when, label);
+        B.bind(skip);
+      }
+      return;
+    }
+    Operator::lower_branch(B, when, label);
+  }
+
+  // an and decided by a false operand, or an or by a true one, is folded only when it is its left one
+  virtual bool fold(int &value) override
+  {
+    if (!is_short_circuit())
+      return Operator::fold(value);
+    left = folded(left);
+    right = folded(right);
+    int l, r;
+    if (!left->get_constant(l))
+      return false;
+    if ((op == '&') != (l != 0))
+    {
+      value = l != 0;
+      return true;
+    }
+    if (!right->get_constant(r))
+      return false;
+    value = r != 0;
+    return true;
+  }
+
+  virtual bool is_condition() const override
+  {
+    return is_comparison(op) || is_short_circuit();
+  }
+
+  // the right operand of a short-circuit operator runs only where the left one did not decide
+  virtual Interval range(const RangeEnv &env) override
+  {
+    if (!is_short_circuit())
+      return Operator::range(env);
+    left->range(env);
+    RangeEnv rest = env;
+    left->refine(rest, op == '&');
+    right->range(rest);
+    return { 0, 1 };
+  }
+
+  virtual void refine(RangeEnv &env, bool when) override
+  {
+    if (!is_short_circuit())
+    {
+      Operator::refine(env, when);
+      return;
     }
-    return nullptr;
+    // an and is true, and an or false, when both operands are
+    if ((op == '&') == when)
+    {
+      left->refine(env, when);
+      right->refine(env, when);
+      return;
+    }
+    // otherwise either the left one decides, or the right one does
+    RangeEnv rest = env;
+    left->refine(env, when);
+    left->refine(rest, !when);
+    right->refine(rest, when);
+    env.join(rest);
   }
 
 private:
   Expr *left;
   char op;
   Expr *right;
+
+  bool is_short_circuit() const
+  {
+    return op == '&' || op == '|';
+  }
 };
 
-class Not : public Expr
+class Not : public Operator
 {
 public:
   Not(Expr *c) : cond(c) {}
-  ~Not() { delete cond; }
   virtual void printOn(std::ostream &out) const override
   {
     out << "Not"
@@ -1178,25 +2866,17 @@ public:
     return !(cond->eval());
   }
 
-  virtual void sem() override
+  virtual FlatKind get_flat_node(Expr *operands[2], char &op, int &value) const override
   {
-    cond->sem();
-    // if(cond->get_kind() == EntryKind::FUNCTION) {
-    //   yyerror("Cannot negate a function");
-    // }
+    operands[0] = cond;
+    return FlatKind::Not;
   }
 
-  virtual bool is_rvalue() const override
+  virtual bool is_condition() const override
   {
     return true;
   }
 
-  virtual llvm::Value *codegen() override {
-    llvm::Value *CondV = cond->codegen();
-    if(!CondV) return nullptr;
-    return Builder.CreateNot(CondV, "nottmp");
-  }
-
 private:
   Expr *cond;
 };
@@ -1205,11 +2885,6 @@ class Block : public Stmt
 {
 public:
   Block() : stmt_list() {}
-  ~Block()
-  {
-    for (Stmt *s : stmt_list)
-      delete s;
-  }
   void append_stmt(Stmt *s) { stmt_list.push_back(s); }
   void printOn(std::ostream &out) const override
   {
@@ -1236,6 +2911,32 @@ public:
       s->sem();
   }
 
+  // nothing after a statement that returns runs, so it goes
+  virtual Stmt *fold(bool unconditional) override
+  {
+    for (size_t i = 0; i < stmt_list.size(); i++)
+    {
+      stmt_list[i] = stmt_list[i]->fold(unconditional);
+      if (stmt_list[i]->returns())
+      {
+        stmt_list.resize(i + 1);
+        break;
+      }
+    }
+    return this;
+  }
+
+  virtual bool returns() const override
+  {
+    return !stmt_list.empty() && stmt_list.back()->returns();
+  }
+
+  virtual void range(RangeEnv &env) override
+  {
+    for (Stmt *s : stmt_list)
+      s->range(env);
+  }
+
   virtual llvm::Value *codegen() override {
     llvm::Value *V = nullptr;
     for (Stmt *s : stmt_list) {
@@ -1245,20 +2946,22 @@ public:
     return c32(0);
   }
 
+  virtual void lower(BytecodeBuilder &B) override {
+    for (Stmt *s : stmt_list) {
+      int mark = B.mark();
+      s->lower(B);
+      B.release(mark);
+    }
+  }
+
 private:
-  std::vector<Stmt *> stmt_list;
+  ArenaVector<Stmt *> stmt_list;
 };
 
 class If : public Stmt
 {
 public:
   If(Expr *c, Stmt *s1, Stmt *s2 = nullptr) : cond(c), stmt1(s1), stmt2(s2) {}
-  ~If()
-  {
-    delete cond;
-    delete stmt1;
-    delete stmt2;
-  }
   void printOn(std::ostream &out) const override
   {
     out << "If(" << *cond << ", " << *stmt1;
@@ -1282,6 +2985,41 @@ public:
       stmt2->sem();
   }
 
+  // with a constant condition, the branch taken takes the place of the if
+  virtual Stmt *fold(bool unconditional) override
+  {
+    cond = Expr::folded(cond);
+    int value;
+    if (cond->get_constant(value))
+    {
+      Stmt *taken = value ? stmt1 : stmt2;
+      if (taken == nullptr)
+        return new EmptyStmt();
+      return taken->fold(unconditional);
+    }
+    stmt1 = stmt1->fold(false);
+    if (stmt2 != nullptr)
+      stmt2 = stmt2->fold(false);
+    return this;
+  }
+
+  virtual bool returns() const override
+  {
+    return stmt2 != nullptr && stmt1->returns() && stmt2->returns();
+  }
+
+  virtual void range(RangeEnv &env) override
+  {
+    cond->range(env);
+    RangeEnv otherwise = env;
+    cond->refine(env, true);
+    stmt1->range(env);
+    cond->refine(otherwise, false);
+    if (stmt2 != nullptr)
+      stmt2->range(otherwise);
+    env.join(otherwise);
+  }
+
   virtual llvm::Value *codegen() override {
     llvm::Value *CondV = cond->codegen();
     if(!CondV) return nullptr;
@@ -1299,7 +3037,8 @@ public:
     llvm::Value *ThenV = stmt1->codegen();
     if(!ThenV) return nullptr;
 
-    if(ThenBB->getTerminator() == nullptr)
+    // the then part may have ended in a block of its own, after a loop
+    if(Builder.GetInsertBlock()->getTerminator() == nullptr)
       Builder.CreateBr(MergeBB);
     ThenBB = Builder.GetInsertBlock();
 
@@ -1325,6 +3064,21 @@ public:
     return MergeBB;
   }
 
+  virtual void lower(BytecodeBuilder &B) override {
+    int else_label = B.new_label();
+    cond->lower_branch(B, false, else_label);
+    stmt1->lower(B);
+    if (stmt2 == nullptr) {
+      B.bind(else_label);
+      return;
+    }
+    int end = B.new_label();
+    B.emit_jump(Op::JMP, end);
+    B.bind(else_label);
+    stmt2->lower(B);
+    B.bind(end);
+  }
+
 private:
   Expr *cond;
   Stmt *stmt1;
@@ -1335,11 +3089,6 @@ class While : public Stmt
 {
 public:
   While(Expr *c, Stmt *s) : cond(c), stmt(s) {}
-  ~While()
-  {
-    delete cond;
-    delete stmt;
-  }
   void printOn(std::ostream &out) const override
   {
     out << "While(" << *cond << " do " << *stmt;
@@ -1357,6 +3106,49 @@ public:
     stmt->sem();
   }
 
+  // a loop that never runs goes
+  virtual Stmt *fold(bool unconditional) override
+  {
+    cond = Expr::folded(cond);
+    int value;
+    if (cond->get_constant(value) && !value)
+      return new EmptyStmt();
+    stmt = stmt->fold(false);
+    return this;
+  }
+
+  /*
+  * The ranges at the head of the loop are the ones before it, joined
+  * with the ones at the end of the body, until they no longer change.
+  * From the third time around the bounds that still move are widened,
+  * so that it takes only a few. The last time through the body is the
+  * one the array accesses in it keep.
+  */
+  virtual void range(RangeEnv &env) override
+  {
+    RangeEnv head = env;
+    for (int i = 0;; i++)
+    {
+      RangeEnv body = head;
+      cond->range(body);
+      cond->refine(body, true);
+      stmt->range(body);
+      RangeEnv next = env;
+      next.join(body);
+      if (i >= 2)
+      {
+        RangeEnv widened = head;
+        widened.widen(next);
+        next = widened;
+      }
+      if (next == head)
+        break;
+      head = next;
+    }
+    env = head;
+    cond->refine(env, false);
+  }
+
   virtual llvm::Value* codegen() override {
     llvm::Function *TheFunction = Builder.GetInsertBlock()->getParent();
 
@@ -1389,37 +3181,27 @@ public:
     return LoopEndBB;
   }
 
+  // the condition goes at the bottom, one jump per iteration
+  virtual void lower(BytecodeBuilder &B) override {
+    int body = B.new_label(), test = B.new_label();
+    B.emit_jump(Op::JMP, test);
+    B.bind(body);
+    if (B.count_loops)
+      B.emit(Op::LOOP);
+    stmt->lower(B);
+    B.bind(test);
+    cond->lower_branch(B, true, body);
+  }
+
 private:
   Expr *cond;
   Stmt *stmt;
 };
 
-class EmptyStmt : public Stmt
-{
-public:
-  EmptyStmt() {}
-  void printOn(std::ostream &out) const override
-  {
-    out << "EmptyStmt()";
-  }
-  void run() const override {}
-
-  virtual void sem() override {} // idk if this is needed
-
-  virtual llvm::Value *codegen() override {
-    return nullptr;
-  }
-};
-
 class Assignment : public Stmt
 {
 public:
   Assignment(Expr *l, Expr *e) : l_value(l), expr(e) {}
-  ~Assignment()
-  {
-    delete l_value;
-    delete expr;
-  }
   void printOn(std::ostream &out) const override
   {
     out << "Assignment(" << *l_value << ", " << *expr << ")";
@@ -1444,7 +3226,44 @@ public:
     }
     // std::cout<<"l_value type: "<<l_value->get_type()<<std::endl;
     // std::cout<<"expr type: "<<expr->get_type()<<std::endl;
-    l_value->type_check(expr->get_type(), expr->get_dimensions());
+    l_value->type_check(expr->get_type(), expr->get_shape());
+    if (Id *id = dynamic_cast<Id *>(l_value))
+    {
+      STEntry *entry = id->get_entry();
+      entry->assignments++;
+      if (!st.is_local(entry))
+        entry->escapes = true;
+    }
+  }
+
+  /*
+  * A local variable assigned once, by an unconditional assignment of a
+  * constant, has that value in every statement after it
+  */
+  virtual Stmt *fold(bool unconditional) override
+  {
+    int value;
+    l_value->fold(value);
+    expr = Expr::folded(expr);
+    Id *id = dynamic_cast<Id *>(l_value);
+    if (unconditional && id != nullptr && expr->get_constant(value))
+    {
+      STEntry *entry = id->get_entry();
+      if (entry->kind == EntryKind::VARIABLE && entry->assignments == 1 && st.is_local(entry))
+      {
+        entry->constant = true;
+        entry->value = value;
+      }
+    }
+    return this;
+  }
+
+  virtual void range(RangeEnv &env) override
+  {
+    l_value->range(env);
+    Interval value = expr->range(env);
+    if (Id *id = dynamic_cast<Id *>(l_value))
+      id->assign_range(env, value);
   }
 
   virtual llvm::Value *codegen() override {
@@ -1454,6 +3273,10 @@ public:
     return c32(0);
   }
 
+  virtual void lower(BytecodeBuilder &B) override {
+    l_value->lower_store(B, expr);
+  }
+
 private:
   Expr *l_value;
   Expr *expr;
@@ -1464,7 +3287,6 @@ class Return : public Stmt
 public:
   Return(Expr *e = nullptr) : expr(e) {}
   Return(int lineno = 0) : expr(nullptr) { line_number = lineno; }
-  ~Return() { delete expr; }
 
   int line_number = 0;
 
@@ -1498,11 +3320,37 @@ public:
     st.set_return_exists();
   }
 
+  virtual Stmt *fold(bool unconditional) override
+  {
+    if (expr != nullptr)
+      expr = Expr::folded(expr);
+    return this;
+  }
+
+  virtual bool returns() const override
+  {
+    return true;
+  }
+
+  virtual void range(RangeEnv &env) override
+  {
+    if (expr != nullptr)
+      expr->range(env);
+    env.reachable = false;
+  }
+
   virtual llvm::Value *codegen() override {
     if(!expr) return Builder.CreateRetVoid();
     return Builder.CreateRet(expr->codegen());
   }
 
+  virtual void lower(BytecodeBuilder &B) override {
+    if (!expr)
+      B.emit(Op::RETV);
+    else
+      B.emit(Op::RET, expr->lower_value(B));
+  }
+
 private:
   Expr *expr;
 };
@@ -1510,12 +3358,12 @@ private:
 class IdList : public AST
 {
 public:
-  std::vector<std::string *> id_list;
-  IdList(std::string *i) { append_id(i); }
+  ArenaVector<Atom> id_list;
+  IdList(Atom i) { append_id(i); }
 
-  void append_id(std::string *id)
+  void append_id(Atom id)
   {
-    id_list.insert(id_list.begin(), id);
+    id_list.push_back(id);
   }
 
   void printOn(std::ostream &out) const override
@@ -1527,7 +3375,7 @@ public:
       if (!first)
         out << ", ";
       first = false;
-      out << *id;
+      out << atoms.name(id);
     }
     out << ")";
   }
@@ -1543,7 +3391,6 @@ public:
   bool missingFirstDimension;
 
   ArrayDimension() : missingFirstDimension(false), dimensions() {}
-  // ~ArrayDimension() { for (IntConst *d : dimensions) delete d; }
 
   void add_dimension(int d)
   {
@@ -1564,7 +3411,14 @@ public:
 
   std::vector<int> getDimensions() const
   {
-    return dimensions;
+    return std::vector<int>(dimensions.begin(), dimensions.end());
+  }
+
+  const Shape *getShape()
+  {
+    if (shape == nullptr)
+      shape = types.shape(getDimensions());
+    return shape;
   }
 
   virtual llvm::Value *codegen() override {
@@ -1572,14 +3426,14 @@ public:
   }
 
 private:
-  std::vector<int> dimensions;
+  ArenaVector<int> dimensions;
+  const Shape *shape = nullptr;
 };
 
 class VariableType : public AST
 {
 public:
   VariableType(DataType t, ArrayDimension *d) : datatype(t), dim(d) {}
-  ~VariableType() { delete dim; }
 
   void printOn(std::ostream &out) const override
   {
@@ -1616,6 +3470,11 @@ public:
     return dim->getDimensions();
   }
 
+  const Shape *getShape() const
+  {
+    return dim->getShape();
+  }
+
   bool getMissingFirstDimension() const
   {
     return dim->missingFirstDimension;
@@ -1633,36 +3492,41 @@ private:
 class FuncParam : public AST
 {
 public:
-  FuncParam(std::string *il, VariableType *t, PassingType pt, int lineno) : id(il), param_type(t), passing_type(pt) {line_number = lineno;}
-  ~FuncParam()
-  {
-    delete id;
-    delete param_type;
-  }
+  FuncParam(Atom il, VariableType *t, PassingType pt, int lineno) : id(il), param_type(t), passing_type(pt) {line_number = lineno;}
 
   int line_number = 0;
 
   void printOn(std::ostream &out) const override
   {
-    out << "FuncParam(" << (bool(passing_type) ? "reference, " : "value, ") << *id << ", " << *param_type << ")";
+    out << "FuncParam(" << (bool(passing_type) ? "reference, " : "value, ") << atoms.name(id) << ", " << *param_type << ")";
+  }
+
+  Param getParam() const
+  {
+    return Param{ param_type->getDataType(), passing_type, param_type->getShape(), param_type->getMissingFirstDimension() };
   }
 
-  std::tuple<DataType, PassingType, std::vector<int>, bool> getParam() const
+  Atom get_param_name() const
   {
-    return std::make_tuple(param_type->getDataType(), passing_type, param_type->getDimensions(), param_type->getMissingFirstDimension());
+    return id;
   }
 
-  std::string get_param_name() const
+  bool is_by_reference() const
   {
-    return *id;
+    return passing_type == PassingType::BY_REFERENCE;
+  }
+
+  int get_byte_size() const
+  {
+    return Expr::byte_size(param_type->getDataType());
   }
 
   virtual void sem() override
   {
-    if(passing_type == PassingType::BY_VALUE && (!param_type->getDimensions().empty() || param_type->getMissingFirstDimension())) {
+    if(passing_type == PassingType::BY_VALUE && (!param_type->getShape()->is_scalar() || param_type->getMissingFirstDimension())) {
       yyerror2("Cannot pass array by value", line_number);
     }
-    st.insert_param(*id, param_type->getDataType(), passing_type, param_type->getDimensions(), param_type->getMissingFirstDimension(), line_number);
+    st.insert_param(id, param_type->getDataType(), passing_type, param_type->getShape(), param_type->getMissingFirstDimension(), line_number);
   }
 
   llvm::Type *get_llvm_type() const {
@@ -1708,7 +3572,7 @@ public:
   }
 
 private:
-  std::string *id;
+  Atom id;
   VariableType *param_type;
   PassingType passing_type;
 };
@@ -1716,7 +3580,7 @@ private:
 class FuncParamList : public AST
 {
 public:
-  std::vector<FuncParam *> param_list;
+  ArenaVector<FuncParam *> param_list;
 
   void add_param(FuncParam *p)
   {
@@ -1730,11 +3594,6 @@ public:
       add_param(new FuncParam(id, fpt, pt, lineno));
     }
   }
-  ~FuncParamList()
-  {
-    for (FuncParam *p : param_list)
-      delete p;
-  }
 
   void join(FuncParamList *other)
   {
@@ -1771,19 +3630,14 @@ public:
 class Header : public AST
 {
 public:
-  Header(std::string *i, DataType t, int lineno, FuncParamList *p = nullptr) : id(i), returntype(t), paramlist(p) {line_number = lineno;}
-  ~Header()
-  {
-    delete id;
-    delete paramlist;
-  }
+  Header(Atom i, DataType t, int lineno, FuncParamList *p = nullptr) : id(i), returntype(t), paramlist(p) {line_number = lineno;}
 
   int line_number = 0;
   int get_line_number() const {return line_number;}
 
   void printOn(std::ostream &out) const override
   {
-    out << "Header(" << *id << ": " << returntype;
+    out << "Header(" << atoms.name(id) << ": " << returntype;
     if (paramlist != nullptr)
       out << ", " << *paramlist;
     out << ")";
@@ -1791,37 +3645,21 @@ public:
 
   bool was_declared() const
   {
-    return st.was_declared(*id);
+    return st.was_declared(id);
   }
 
   void declare() {
     if(was_declared()) {
       yyerror2("Function already declared", line_number);
     }
-    std::vector<std::tuple<DataType, PassingType, std::vector<int>, bool>> param_types;
-    if (paramlist != nullptr)
-    {
-      for (const auto &p : paramlist->param_list)
-      {
-        param_types.push_back(p->getParam());
-      }
-    }
-    st.insert_function_declaration(*id, returntype, param_types, line_number);
+    st.insert_function_declaration(id, get_signature(), line_number);
   }
 
   void define() {
     if(!was_declared()) {
       yyerror2("Function not declared", line_number);
     }
-    std::vector<std::tuple<DataType, PassingType, std::vector<int>, bool>> param_types;
-    if (paramlist != nullptr)
-    {
-      for (const auto &p : paramlist->param_list)
-      {
-        param_types.push_back(p->getParam());
-      }
-    }
-    st.insert_function_definition(*id, returntype, param_types, line_number);
+    st.insert_function_definition(id, get_signature(), line_number);
   }
 
   void define_main(){
@@ -1831,20 +3669,30 @@ public:
     if(returntype != DataType::TYPE_nothing) {
       yyerror2("Main function must return nothing", line_number);
     }
-    st.insert_function(*id, returntype, std::vector<std::tuple<DataType, PassingType, std::vector<int>, bool>>(), line_number);
+    st.insert_function(id, get_signature(), line_number);
   }
 
   virtual void sem() override
   {
-    std::vector<std::tuple<DataType, PassingType, std::vector<int>, bool>> param_types;
-    if (paramlist != nullptr)
+    st.insert_function(id, get_signature(), line_number);
+  }
+
+  // built once, for the declaration and the definition alike
+  const Signature *get_signature()
+  {
+    if (signature == nullptr)
     {
-      for (const auto &p : paramlist->param_list)
+      std::vector<Param> params;
+      if (paramlist != nullptr)
       {
-        param_types.push_back(p->getParam());
+        for (const auto &p : paramlist->param_list)
+        {
+          params.push_back(p->getParam());
+        }
       }
+      signature = types.signature(returntype, params);
     }
-    st.insert_function(*id, returntype, param_types, line_number);
+    return signature;
   }
 
   void register_param_list()
@@ -1855,9 +3703,9 @@ public:
     }
   }
 
-  std::string get_name() const
+  Atom get_name() const
   {
-    return *id;
+    return id;
   }
 
   DataType get_return_type() const
@@ -1869,11 +3717,24 @@ public:
   {
     if (paramlist == nullptr)
       return 0;
-    return paramlist->param_list.size();
+    return paramlist->param_list.size() + get_size_params().size();
+  }
+
+  // with -fbounds-check, each array parameter of unknown size has its first dimension in one more, after the others
+  std::vector<Atom> get_size_params() const
+  {
+    std::vector<Atom> sizes;
+    if (bounds_check && paramlist != nullptr)
+    {
+      for (const auto &p : paramlist->param_list)
+        if (p->getParam().missing_first_dimension)
+          sizes.push_back(size_atom(p->get_param_name()));
+    }
+    return sizes;
   }
 
   llvm::FunctionType *get_llvm_function_type() {
-    std::string current_function_name = std::string(Builder.GetInsertBlock()->getParent()->getName());
+    Atom current_function_name = current_function();
     std::vector<llvm::Type *> locals_params(NamedValues[current_function_name].size());
     int i = 0;
     llvm::Type *local_value_type;
@@ -1921,6 +3782,7 @@ public:
       {
         llvm_param_types[i] = paramlist->param_list[i]->get_llvm_type();
       }
+      llvm_param_types.insert(llvm_param_types.end(), get_size_params().size(), i32);
       std::vector<llvm::Type *> argument_types(locals_params.size() + llvm_param_types.size());
       std::copy(llvm_param_types.begin(), llvm_param_types.end(), argument_types.begin());
       std::copy(locals_params.begin(), locals_params.end(), argument_types.begin() + llvm_param_types.size());
@@ -1938,29 +3800,58 @@ public:
 
   virtual llvm::Function *codegen() override {
     llvm::FunctionType *FT = get_llvm_function_type();
-    std::string function_name = std::string("user_") + *id;
+    const std::string &function_name = atoms.name(atoms.user(id));
     llvm::Function *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, function_name, TheModule.get());
+    set_target_attributes(F);
     //set argument names
     unsigned long int i = 0;
+    std::vector<Atom> sizes = get_size_params();
     //TODO : UPDATE THIS
     for (auto &Arg : F->args()) {
       if(paramlist == nullptr) {
         Arg.setName(std::string("local") + std::to_string(i++));
         continue;
       }
-      if(i >= paramlist->param_list.size()) {
+      if(i >= paramlist->param_list.size() + sizes.size()) {
         Arg.setName(std::string("local") + std::to_string(i++));
         continue;
       }
-      Arg.setName(paramlist->param_list[i++]->get_param_name());
+      if(i >= paramlist->param_list.size()) {
+        Arg.setName(atoms.name(sizes[i++ - paramlist->param_list.size()]));
+        continue;
+      }
+      Arg.setName(atoms.name(paramlist->param_list[i++]->get_param_name()));
     }
     return F;
   }
 
+  // declares the function in the enclosing scope of the bytecode, or in none for the evaluator
+  int lower(BytecodeBuilder &B, bool scoped = true) {
+    std::vector<bool> by_reference;
+    std::vector<int32_t> sizes;
+    if (paramlist != nullptr) {
+      for (const auto &p : paramlist->param_list) {
+        by_reference.push_back(p->is_by_reference());
+        sizes.push_back(p->get_byte_size());
+      }
+    }
+    if (!scoped)
+      return B.add_function(id, by_reference, sizes);
+    return B.declare_function(id, by_reference, sizes);
+  }
+
+  void lower_params(BytecodeBuilder &B) {
+    if (paramlist == nullptr)
+      return;
+    for (unsigned i = 0; i < paramlist->param_list.size(); i++)
+      B.declare_parameter(paramlist->param_list[i]->get_param_name(), i, paramlist->param_list[i]->get_byte_size());
+  }
+
 private:
-  std::string *id;
+  Atom id;
   DataType returntype;
   FuncParamList *paramlist;
+  const Signature *signature = nullptr;
 };
 
 class LocalDefinition : public AST
@@ -1968,31 +3859,27 @@ class LocalDefinition : public AST
 public:
   virtual void printOn(std::ostream &out) const = 0;
   virtual bool isVariableDefinition() const { return false; }
-  virtual std::string get_variable_name() const { return ""; }
+  virtual Atom get_variable_name() const { return 0; }
   virtual llvm::Value *get_init_value() const { return nullptr; }
   virtual llvm::Type *get_llvm_variable_type() const { return nullptr; }
+  virtual void lower(BytecodeBuilder &B) {}
   int line_number = 0;
 };
 
 class VariableDefinition : public LocalDefinition
 {
 public:
-  VariableDefinition(std::string *i, VariableType *vt, int lineno) : id(i), variable_type(vt) {line_number = lineno;}
-  ~VariableDefinition()
-  {
-    delete id;
-    delete variable_type;
-  }
+  VariableDefinition(Atom i, VariableType *vt, int lineno) : id(i), variable_type(vt) {line_number = lineno;}
   void printOn(std::ostream &out) const override
   {
-    out << "VariableDefinition(" << *id << ", " << *variable_type << ")";
+    out << "VariableDefinition(" << atoms.name(id) << ", " << *variable_type << ")";
   }
 
   virtual bool isVariableDefinition() const override { return true; }
 
-  virtual std::string get_variable_name() const override
+  virtual Atom get_variable_name() const override
   {
-    return *id;
+    return id;
   }
 
   virtual llvm::Type *get_llvm_variable_type() const override
@@ -2016,22 +3903,30 @@ public:
 
   virtual void sem() override
   {
-    st.insert_variable(*id, variable_type->getDataType(), variable_type->getDimensions(), line_number);
+    st.insert_variable(id, variable_type->getDataType(), variable_type->getShape(), line_number);
   }
 
   virtual llvm::AllocaInst *codegen() override {
     return nullptr;
   }
 
+  virtual void lower(BytecodeBuilder &B) override
+  {
+    int count = 1;
+    for (int d : variable_type->getShape()->dimensions)
+      count *= d;
+    B.declare_variable(id, Expr::byte_size(variable_type->getDataType()), count);
+  }
+
 private:
-  std::string *id;
+  Atom id;
   VariableType *variable_type;
 };
 
 class LocalDefinitionList : public AST
 {
 public:
-  std::vector<std::shared_ptr<LocalDefinition>> local_definition_list;
+  ArenaVector<LocalDefinition *> local_definition_list;
 
   unsigned int get_vars_count() const
   {
@@ -2056,7 +3951,7 @@ public:
 
   void add_local_definition(LocalDefinition *ld)
   {
-    local_definition_list.push_back(std::shared_ptr<LocalDefinition>(ld));
+    local_definition_list.push_back(ld);
   }
 
   void join(LocalDefinitionList *other)
@@ -2110,28 +4005,28 @@ public:
 
   virtual llvm::Value *codegen() override {
     llvm::BasicBlock *OuterBlock = Builder.GetInsertBlock();
-    std::string function_parent_name = std::string(OuterBlock->getParent()->getName());
+    Atom function_parent_name = name_atom(OuterBlock->getParent());
 
     llvm::Function *TheFunction = header->codegen();
     llvm::BasicBlock *L1 = llvm::BasicBlock::Create(TheContext, "entry", TheFunction);
     Builder.SetInsertPoint(L1);
-    std::string function_name = std::string(TheFunction->getName());
-    FunctionTranslationTablesRealToLocal[function_name] = new std::map<std::string, std::string>();
-    FunctionTranslationTablesLocalToReal[function_name] = new std::map<std::string, std::string>();
-    std::map<std::string, std::string> *RealToLocalTranslations = FunctionTranslationTablesRealToLocal[function_name];
-    std::map<std::string, std::string> *LocalToRealTranslations = FunctionTranslationTablesLocalToReal[function_name];
-
-    std::map<std::string, std::string> *OldLocalToRealTranslations = FunctionTranslationTablesLocalToReal[function_parent_name];
-    std::map<std::string, llvm::Value *>::iterator it = NamedValues[function_parent_name].begin();
+    Atom function_name = name_atom(TheFunction);
+    FunctionTranslationTablesRealToLocal[function_name] = new std::map<Atom, Atom>();
+    FunctionTranslationTablesLocalToReal[function_name] = new std::map<Atom, Atom>();
+    std::map<Atom, Atom> *RealToLocalTranslations = FunctionTranslationTablesRealToLocal[function_name];
+    std::map<Atom, Atom> *LocalToRealTranslations = FunctionTranslationTablesLocalToReal[function_name];
+
+    std::map<Atom, Atom> *OldLocalToRealTranslations = FunctionTranslationTablesLocalToReal[function_parent_name];
+    std::map<Atom, llvm::Value *>::iterator it = NamedValues[function_parent_name].begin();
     for (auto argIt = TheFunction->arg_begin(); argIt != TheFunction->arg_end(); ++argIt) {
       llvm::Value *arg = &*argIt;
-      std::string arg_name = std::string(arg->getName());
+      Atom arg_name = name_atom(arg);
       if(argIt < TheFunction->arg_begin() + header->get_params_size()) {
         (*RealToLocalTranslations)[arg_name] = arg_name;
         (*LocalToRealTranslations)[arg_name] = arg_name;
         // std::cout << "Translating " << arg_name << " to " << arg_name << std::endl;
         // AST::logToFile("Translating arg " + arg_name + " to " + arg_name);
-        llvm::AllocaInst *alloca = Builder.CreateAlloca(argIt->getType(), nullptr, arg_name);
+        llvm::AllocaInst *alloca = Builder.CreateAlloca(argIt->getType(), nullptr, atoms.name(arg_name));
         Builder.CreateStore(argIt, alloca);
         // AST::logToFile("Creating alloca for " + arg_name + " in function " + function_name);
         NamedValues[function_name][arg_name] = alloca;
@@ -2148,7 +4043,7 @@ public:
       }
       (*LocalToRealTranslations)[arg_name] = (*OldLocalToRealTranslations)[it->first];
       // std::cout << "Translating " << (*OldLocalToRealTranslations)[*it] << " to " << arg_name << std::endl;
-      llvm::AllocaInst *alloca = Builder.CreateAlloca(argIt->getType(), nullptr, arg_name);
+      llvm::AllocaInst *alloca = Builder.CreateAlloca(argIt->getType(), nullptr, atoms.name(arg_name));
       Builder.CreateStore(argIt, alloca);
       // AST::logToFile("Creating alloca for " + arg_name + " in function " + function_name);
       NamedValues[function_name][arg_name] = alloca;
@@ -2159,6 +4054,10 @@ public:
     return nullptr;
   }
 
+  virtual void lower(BytecodeBuilder &B) override {
+    header->lower(B);
+  }
+
 private:
   Header *header;
 };
@@ -2166,84 +4065,214 @@ private:
 class FunctionDefinition : public LocalDefinition
 {
 public:
-  FunctionDefinition(Header *h, LocalDefinitionList *d, Block *b, int lineno = 0) : header(h), definition_list(d), block(b) {line_number = lineno;}
-  ~FunctionDefinition() {
-    // AST::logToFile("Deleting function definition");
-    delete header;
-    delete definition_list;
-    delete block;
-  }
+  FunctionDefinition(Header *h) : header(h), outermost(false), OuterBlock(nullptr), TheFunction(nullptr) {}
 
   void printOn(std::ostream &out) const override
   {
-    out << "FunctionDefinition(" << *header << ", " << *definition_list << ", " << *block << ")";
+    out << "FunctionDefinition(" << *header << ")";
   }
 
   virtual bool isVariableDefinition() const override { return false; }
 
-  virtual void sem() override
+  /*
+  * A function is checked and compiled in three steps, as the parser
+  * reaches its header, each of its local definitions and its body:
+  * open(), define() and close(). The nested functions are done by the
+  * time they show up among the local definitions, so there is nothing
+  * left for sem(), codegen() or lower() to do with them. Once the body
+  * is done, what the parser built for the function goes back to the
+  * arena; the header stays, and so do the symbol table entry and the
+  * translation tables that the calls to the function need.
+  */
+  void open()
+  {
+    {
+      PhaseTimer timer("sem");
+      outermost = st.not_exists_scope();
+      if (outermost) {
+        //main (outermost) function
+        st.openScope();
+        st.init_library_functions();
+        header->define_main();
+      }
+      else if(!header->was_declared()){
+        header->sem();
+      }
+      else {
+        header->define();
+      }
+      st.openScope(header->get_return_type(), outermost ? nullptr : st.lookup(header->get_name()));
+      if (!outermost)
+        header->register_param_list();
+    }
+    if (interpret_program) {
+      PhaseTimer timer("lower");
+      int index = header->lower(*Bytecode);
+      Bytecode->begin_function(index);
+      header->lower_params(*Bytecode);
+    }
+    else {
+      PhaseTimer timer("codegen");
+      codegen_header();
+    }
+    // the header and this node are in the arena before the mark
+    mark = ast_arena.mark();
+  }
+
+  void define(LocalDefinitionList *definitions)
+  {
+    for (const auto &ld : definitions->local_definition_list) {
+      {
+        PhaseTimer timer("sem");
+        ld->sem();
+      }
+      if (ld->isVariableDefinition())
+        variables.push_back(ld);
+      if (interpret_program) {
+        PhaseTimer timer("lower");
+        ld->lower(*Bytecode);
+      }
+      else {
+        PhaseTimer timer("codegen");
+        codegen_local_definition(ld);
+      }
+    }
+  }
+
+  void close(Block *block, int lineno)
   {
-    if (st.not_exists_scope()) {
-      //main (outermost) function
-      st.openScope();
-      st.init_library_functions();
-      header->define_main();
-      st.openScope(header->get_return_type());
-      definition_list->sem();
+    line_number = lineno;
+    {
+      PhaseTimer timer("sem");
       block->sem();
+      if (!outermost)
+        st.check_return_exists(line_number);
       st.check_undefined_functions();
+      {
+        // while the symbol table still has the variables of the function
+        PhaseTimer timer("fold");
+        block->fold(true);
+        if (st.is_pure())
+          lower_evaluable(block);
+      }
+      if (bounds_check && !interpret_program) {
+        // the checks the range analysis proves unneeded are left out of the code
+        PhaseTimer timer("range");
+        RangeEnv env;
+        block->range(env);
+      }
       st.closeScope();
-      return;
     }
-    if(!header->was_declared()){
-      header->sem();
+    if (interpret_program) {
+      PhaseTimer timer("lower");
+      block->lower(*Bytecode);
+      Bytecode->end_function(header->get_return_type() != DataType::TYPE_nothing);
     }
     else {
-      header->define();
+      PhaseTimer timer("codegen");
+      codegen_body(block);
     }
-    st.openScope(header->get_return_type());
-    header->register_param_list();
-    definition_list->sem();
-    block->sem();
-    st.check_return_exists(line_number);
-    st.check_undefined_functions();
-    // std::cout<<"Before end of scope"<<std::endl;
-    // st.display();
-    st.closeScope();
-    // std::cout<<"After end of scope"<<std::endl;
-    // st.display();
+    ast_arena.reset(mark);
   }
 
   virtual llvm::Value *codegen() override {
+    return nullptr;
+  }
+
+  // Starts the compilation of a program, before its outermost function is parsed
+  static void begin_program()
+  {
+    evaluator.clear();
+    if (interpret_program) {
+      Bytecode.reset(new BytecodeBuilder());
+      Bytecode->count_loops = tiered_execution;
+    }
+    else {
+      llvm_start_module(optimization_level);
+    }
+  }
+
+  // Finishes it, once the outermost function is closed
+  void end_program()
+  {
+    if (interpret_program)
+      interpret();
+    else
+      llvm_compile_and_dump(optimization_level);
+  }
+
+  /*
+  * Runs the checked program on the bytecode interpreter,
+  * without generating any llvm code up front. In the tiered mode
+  * the hot functions get compiled while the program runs.
+  */
+  void interpret() {
+    std::unique_ptr<BytecodeBuilder> B = std::move(Bytecode);
+    PhaseTimer timer("run");
+    VM vm(B->program);
+    std::unique_ptr<TieredCompiler> tier;
+    if (tiered_execution)
+      tier.reset(new TieredCompiler(vm));
+    vm.run(B->lookup_function(header->get_name()));
+  }
+
+  // the bytecode of the program being lowered, when it is interpreted
+  static thread_local std::unique_ptr<BytecodeBuilder> Bytecode;
+
+private:
+  Header *header;
+  bool outermost;
+  Arena::Mark mark;
+  ArenaVector<LocalDefinition *> variables;
+  llvm::BasicBlock *OuterBlock;
+  llvm::Function *TheFunction;
+
+  // the evaluator gets its own bytecode of a pure function, which calls the others by their indices there
+  void lower_evaluable(Block *block) {
+    BytecodeBuilder &B = evaluator.builder;
+    int index = header->lower(B, false);
+    B.begin_function(index);
+    B.bind_function(header->get_name(), index);
+    for (const auto &callee : st.get_callees())
+      B.bind_function(callee.first, callee.second);
+    header->lower_params(B);
+    for (const auto &ld : variables)
+      ld->lower(B);
+    block->lower(B);
+    B.end_function(header->get_return_type() != DataType::TYPE_nothing);
+    st.get_function()->evaluator_index = index;
+  }
+
+  void codegen_header() {
     //get outer function
-    llvm::BasicBlock *OuterBlock = Builder.GetInsertBlock();
-    std::string function_name = std::string("user_") + header->get_name();
-    std::string function_parent_name = std::string(OuterBlock->getParent()->getName());
-    llvm::Function *TheFunction = TheModule->getFunction(function_name);
+    OuterBlock = Builder.GetInsertBlock();
+    Atom function_name = atoms.user(header->get_name());
+    Atom function_parent_name = name_atom(OuterBlock->getParent());
+    TheFunction = TheModule->getFunction(atoms.name(function_name));
     llvm::BasicBlock *L1;
-    std::map<std::string, std::string> *RealToLocalTranslations;
-    std::map<std::string, std::string> *LocalToRealTranslations;
+    std::map<Atom, Atom> *RealToLocalTranslations;
+    std::map<Atom, Atom> *LocalToRealTranslations;
     if(TheFunction == nullptr) {
       // std::cout << "Function " << header->get_name() << " was not declared" << std::endl;
       TheFunction = header->codegen();
       L1 = llvm::BasicBlock::Create(TheContext, "entry", TheFunction);
       Builder.SetInsertPoint(L1);
-      FunctionTranslationTablesRealToLocal[function_name] = new std::map<std::string, std::string>();
-      FunctionTranslationTablesLocalToReal[function_name] = new std::map<std::string, std::string>();
+      FunctionTranslationTablesRealToLocal[function_name] = new std::map<Atom, Atom>();
+      FunctionTranslationTablesLocalToReal[function_name] = new std::map<Atom, Atom>();
       RealToLocalTranslations = FunctionTranslationTablesRealToLocal[function_name];
       LocalToRealTranslations = FunctionTranslationTablesLocalToReal[function_name];
-      std::map<std::string, std::string> *OldLocalToRealTranslations = FunctionTranslationTablesLocalToReal[function_parent_name];
+      std::map<Atom, Atom> *OldLocalToRealTranslations = FunctionTranslationTablesLocalToReal[function_parent_name];
     
-      std::map<std::string, llvm::Value *>::iterator it = NamedValues[function_parent_name].begin();
+      std::map<Atom, llvm::Value *>::iterator it = NamedValues[function_parent_name].begin();
       for (auto argIt = TheFunction->arg_begin(); argIt != TheFunction->arg_end(); ++argIt) {
         llvm::Value *arg = &*argIt;
-        std::string arg_name = std::string(arg->getName());
+        Atom arg_name = name_atom(arg);
         if(argIt < TheFunction->arg_begin() + header->get_params_size()) {
           (*RealToLocalTranslations)[arg_name] = arg_name;
           (*LocalToRealTranslations)[arg_name] = arg_name;
           // std::cout << "Translating " << arg_name << " to " << arg_name << std::endl;
           // AST::logToFile("Translating arg " + arg_name + " to " + arg_name);
-          llvm::AllocaInst *alloca = Builder.CreateAlloca(argIt->getType(), nullptr, arg_name);
+          llvm::AllocaInst *alloca = Builder.CreateAlloca(argIt->getType(), nullptr, atoms.name(arg_name));
           Builder.CreateStore(argIt, alloca);
           // AST::logToFile("Creating alloca for " + arg_name + " in function " + function_name);
           NamedValues[function_name][arg_name] = alloca;
@@ -2260,7 +4289,7 @@ public:
         }
         (*LocalToRealTranslations)[arg_name] = (*OldLocalToRealTranslations)[it->first];
         // std::cout << "Translating " << (*OldLocalToRealTranslations)[*it] << " to " << arg_name << std::endl;
-        llvm::AllocaInst *alloca = Builder.CreateAlloca(argIt->getType(), nullptr, arg_name);
+        llvm::AllocaInst *alloca = Builder.CreateAlloca(argIt->getType(), nullptr, atoms.name(arg_name));
         Builder.CreateStore(argIt, alloca);
         // AST::logToFile("Creating alloca for " + arg_name + " in function " + function_name);
         NamedValues[function_name][arg_name] = alloca;
@@ -2270,8 +4299,6 @@ public:
     else {
       llvm::BasicBlock &lastBlock = TheFunction->back();
       Builder.SetInsertPoint(&lastBlock, lastBlock.end());
-      RealToLocalTranslations = FunctionTranslationTablesRealToLocal[function_name];
-      LocalToRealTranslations = FunctionTranslationTablesLocalToReal[function_name];
     }
 
     // std::map<std::string, std::string> *OldLocalToRealTranslations = FunctionTranslationTablesLocalToReal[std::string(OuterBlock->getParent()->getName())];
@@ -2302,44 +4329,52 @@ public:
     //   NamedValues[function_name][param_name] = alloca;
     //   ++it;
     // }
-    for (const auto &ld : definition_list->local_definition_list) {
-      if(ld == nullptr) yyerror2("Warning: Found a null shared_ptr in local_definition_list.", 0);
-      if(ld->isVariableDefinition()) {
-        std::string var_name = ld->get_variable_name();
-        llvm::Type *var_type = ld->get_llvm_variable_type();
-        llvm::Value *alloca = Builder.CreateAlloca(var_type, nullptr, var_name);
-        // llvm::Value *init = ld->get_init_value();
-        // Builder.CreateStore(init, alloca);
-        // OldBindings.push_back(NamedValues[var_name]);
-        // DeclaredVariables.push_back(var_name);
-        if(alloca->getType()->isPointerTy() && alloca->getType()->getPointerElementType()->isArrayTy()) {
-          alloca = Builder.CreateGEP(alloca, std::vector<llvm::Value *>({c32(0), c32(0)}), var_name);
-        }
-        NamedValues[function_name][var_name] = alloca;
-        std::pair<std::map<std::string, std::string>::iterator, bool> ret;
-        ret = RealToLocalTranslations->insert(std::pair<std::string, std::string>(var_name, var_name));
-        if(!ret.second) {
-          // AST::logToFile("Variable " + var_name + " already declared in function " + function_name + " OVERWRITING");
-          (*RealToLocalTranslations)[var_name] = var_name;
-          // RealToLocalTranslations->emplace(var_name, var_name);
-        }
-        ret = LocalToRealTranslations->insert(std::pair<std::string, std::string>(var_name, var_name));
-        if(!ret.second) {
-          // AST::logToFile("Variable " + var_name + " already declared in function " + function_name + " OVERWRITING");
-          (*LocalToRealTranslations)[var_name] = var_name;
-          // LocalToRealTranslations->emplace(var_name, var_name);
-        }
-        // AST::logToFile("Translating (declared) " + var_name + " to " + var_name + " in function " + function_name);
-        // std::cout << "Translating (declared) " << var_name << " to " << var_name << std::endl;
-        // RealToLocalTranslations->insert(std::pair<std::string, std::string>(var_name, var_name));
-        // LocalToRealTranslations->insert(std::pair<std::string, std::string>(var_name, var_name));
-        // AST::logToFile("Translating (declared) " + var_name + " to " + var_name);
-        // std::cout << "Translating (declared) " << var_name << " to " << var_name << std::endl;
+  }
+
+  void codegen_local_definition(LocalDefinition *ld) {
+    Atom function_name = atoms.user(header->get_name());
+    std::map<Atom, Atom> *RealToLocalTranslations = FunctionTranslationTablesRealToLocal[function_name];
+    std::map<Atom, Atom> *LocalToRealTranslations = FunctionTranslationTablesLocalToReal[function_name];
+    if(ld == nullptr) yyerror2("Warning: Found a null pointer in local_definition_list.", 0);
+    if(ld->isVariableDefinition()) {
+      Atom var_name = ld->get_variable_name();
+      llvm::Type *var_type = ld->get_llvm_variable_type();
+      llvm::Value *alloca = Builder.CreateAlloca(var_type, nullptr, atoms.name(var_name));
+      // llvm::Value *init = ld->get_init_value();
+      // Builder.CreateStore(init, alloca);
+      // OldBindings.push_back(NamedValues[var_name]);
+      // DeclaredVariables.push_back(var_name);
+      if(alloca->getType()->isPointerTy() && alloca->getType()->getPointerElementType()->isArrayTy()) {
+        alloca = Builder.CreateGEP(alloca, std::vector<llvm::Value *>({c32(0), c32(0)}), atoms.name(var_name));
       }
-      else {
-        ld->codegen();
+      NamedValues[function_name][var_name] = alloca;
+      std::pair<std::map<Atom, Atom>::iterator, bool> ret;
+      ret = RealToLocalTranslations->insert(std::pair<Atom, Atom>(var_name, var_name));
+      if(!ret.second) {
+        // AST::logToFile("Variable " + var_name + " already declared in function " + function_name + " OVERWRITING");
+        (*RealToLocalTranslations)[var_name] = var_name;
+        // RealToLocalTranslations->emplace(var_name, var_name);
       }
+      ret = LocalToRealTranslations->insert(std::pair<Atom, Atom>(var_name, var_name));
+      if(!ret.second) {
+        // AST::logToFile("Variable " + var_name + " already declared in function " + function_name + " OVERWRITING");
+        (*LocalToRealTranslations)[var_name] = var_name;
+        // LocalToRealTranslations->emplace(var_name, var_name);
+      }
+      // AST::logToFile("Translating (declared) " + var_name + " to " + var_name + " in function " + function_name);
+      // std::cout << "Translating (declared) " << var_name << " to " << var_name << std::endl;
+      // RealToLocalTranslations->insert(std::pair<std::string, std::string>(var_name, var_name));
+      // LocalToRealTranslations->insert(std::pair<std::string, std::string>(var_name, var_name));
+      // AST::logToFile("Translating (declared) " + var_name + " to " + var_name);
+      // std::cout << "Translating (declared) " << var_name << " to " << var_name << std::endl;
+    }
+    else {
+      ld->codegen();
     }
+  }
+
+  void codegen_body(Block *block) {
+    Atom function_name = atoms.user(header->get_name());
     //handle function body
     block->codegen();
 
@@ -2355,17 +4390,18 @@ public:
       if(header->get_return_type() == DataType::TYPE_char)
         Builder.CreateRet(c8(0));
     }
+    // The function is complete, clean it up while it is still hot
+    if(streaming_optimization) {
+      PhaseTimer timer("optimize");
+      TheFPM->run(*TheFunction);
+      StreamedFunctions.insert(TheFunction);
+    }
+    // its allocas may have been promoted away, and no one looks them up anymore
+    NamedValues.erase(function_name);
+
     Builder.SetInsertPoint(OuterBlock);
     if(OuterBlock->getParent()->getName() == "main") {
       Builder.CreateCall(TheFunction);
     }
-
-    // TheFPM->run(*TheFunction);
-    return nullptr;
   }
-
-private:
-  Header *header;
-  LocalDefinitionList *definition_list;
-  Block *block;
 };
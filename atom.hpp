@@ -0,0 +1,112 @@
+#ifndef __ATOM_HPP__
+#define __ATOM_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+/*
+* Every identifier is interned once, when the scanner finds it, and
+* is a 32-bit atom from then on: the symbol table, the AST and the
+* code generators compare and hash atoms instead of strings.
+* Atom 0 is the empty name, which is what a failed lookup returns.
+* The runtime library comes right after it, in the order of
+* LibraryFunction, so its atoms are the same in every table.
+*/
+typedef uint32_t Atom;
+
+class AtomTable {
+public:
+  static const Atom first_library_atom = 1;
+  static const Atom library_atom_count = 12;
+
+  AtomTable() : slots(1024, empty)
+  {
+    static const char *const library[library_atom_count] = {
+      "writeInteger", "writeChar", "writeString", "readInteger", "readChar", "readString",
+      "ascii", "chr", "strlen", "strcmp", "strcpy", "strcat"
+    };
+    intern("", 0);
+    for (const char *name : library)
+      intern(name, std::strlen(name));
+  }
+
+  static bool is_library(Atom atom)
+  {
+    return atom >= first_library_atom && atom < first_library_atom + library_atom_count;
+  }
+
+  Atom intern(const char *text, size_t length)
+  {
+    uint32_t hash = hash_of(text, length);
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      Atom atom = slots[i];
+      if (atom == empty) {
+        atom = names.size();
+        names.emplace_back(text, length);
+        hashes.push_back(hash);
+        user_names.push_back(empty);
+        slots[i] = atom;
+        if (names.size() * 2 > slots.size())
+          grow();
+        return atom;
+      }
+      if (hashes[atom] == hash && names[atom].size() == length && std::memcmp(names[atom].data(), text, length) == 0)
+        return atom;
+    }
+  }
+
+  Atom intern(const std::string &name) { return intern(name.data(), name.size()); }
+
+  // the names stay where they are as the table grows
+  const std::string &name(Atom atom) const { return names[atom]; }
+
+  // the atom of "user_" + name, the name a program's identifier gets in the generated code
+  Atom user(Atom atom)
+  {
+    if (user_names[atom] == empty) {
+      Atom prefixed = intern("user_" + names[atom]);
+      user_names[atom] = prefixed;
+    }
+    return user_names[atom];
+  }
+
+private:
+  // an enumerator, so that passing it by reference needs no definition
+  enum : Atom { empty = UINT32_MAX };
+
+  std::deque<std::string> names;
+  std::vector<uint32_t> hashes;
+  std::vector<Atom> user_names;
+  // open addressing, at most half full
+  std::vector<Atom> slots;
+
+  static uint32_t hash_of(const char *text, size_t length)
+  {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+      hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    return hash;
+  }
+
+  void grow()
+  {
+    std::vector<Atom> larger(slots.size() * 2, empty);
+    size_t mask = larger.size() - 1;
+    for (Atom atom = 0; atom < names.size(); atom++) {
+      size_t i = hashes[atom] & mask;
+      while (larger[i] != empty)
+        i = (i + 1) & mask;
+      larger[i] = atom;
+    }
+    slots.swap(larger);
+  }
+};
+
+// Every thread compiles with its own table, like its own symbol table
+extern thread_local AtomTable atoms;
+
+#endif
@@ -0,0 +1,47 @@
+#include <stdio.h>
+
+/*
+ * C has no nested functions, so every level gets a pointer to the
+ * frame of its parent, like the static link of the Grace functions.
+ */
+struct main_frame { int total; };
+struct outer_frame { struct main_frame *up; int a, x; };
+struct middle_frame { struct outer_frame *up; int b, y; };
+struct inner_frame { struct middle_frame *up; int c, z; };
+
+static void innermost(struct inner_frame *up, int d)
+{
+  struct middle_frame *m = up->up;
+  struct outer_frame *o = m->up;
+  o->up->total = (o->up->total + o->x * d + m->y * up->c + up->z - o->a) % 10007;
+}
+
+static void inner(struct middle_frame *up, int c)
+{
+  struct inner_frame f = { up, c, c % 7 };
+  innermost(&f, c);
+  innermost(&f, c + up->b);
+}
+
+static void middle(struct outer_frame *up, int b)
+{
+  struct middle_frame f = { up, b, b % 11 };
+  int k;
+  for (k = 0; k < 20; k++) inner(&f, k + up->a);
+}
+
+static void outer(struct main_frame *up, int a)
+{
+  struct outer_frame f = { up, a, a % 13 };
+  int j;
+  for (j = 0; j < 50; j++) middle(&f, j);
+}
+
+int main(void)
+{
+  struct main_frame f = { 0 };
+  int i;
+  for (i = 0; i < 2000; i++) outer(&f, i);
+  printf("%d\n", f.total);
+  return 0;
+}
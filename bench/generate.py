@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""
+Generates Grace programs of a given shape and size, to measure how the
+compile time of gracec grows with each dimension of a program:
+
+  siblings  N functions side by side in main, each called once
+  nesting   N functions, each nested in the previous one
+  locals    N locals in main, used by a few nested functions
+  expr      an expression chain of N operands, on a value read at run time
+  args      a function of N parameters and a call of it
+  string    string literals of N characters
+  comments  N documented functions, mostly comments and blanks
+
+Usage: generate.py <shape> <size> > program.grc
+"""
+
+import sys
+
+
+def siblings(n):
+    out = ["fun main() : nothing", "  var s : int;"]
+    for i in range(n):
+        out.append(f"  fun f{i}(x : int) : int {{ return x + {i % 10}; }}")
+    out.append("{")
+    out.append("  s <- 0;")
+    for i in range(n):
+        out.append(f"  s <- f{i}(s) mod 1000;")
+    out.append("  writeInteger(s); writeChar('\\n');")
+    out.append("}")
+    return out
+
+
+def nesting(n):
+    # f1 is nested in main, f2 in f1, ..., and each one calls its child
+    out = ["fun main() : nothing", "  var v0 : int;"]
+    for i in range(1, n + 1):
+        indent = "  " * i
+        out.append(f"{indent}fun f{i}() : nothing")
+        out.append(f"{indent}  var v{i} : int;")
+    for i in range(n, -1, -1):
+        indent = "  " * i
+        if i == n:
+            body = f"v{i} <- v{i - 1} + v0; writeInteger(v{i}); writeChar('\\n');"
+        elif i == 0:
+            body = f"v0 <- 1; f1();"
+        else:
+            body = f"v{i} <- v{i - 1} + 1; f{i + 1}();"
+        out.append(f"{indent}{{ {body} }}")
+    return out
+
+
+def locals(n):
+    out = ["fun main() : nothing"]
+    for i in range(n):
+        out.append(f"  var l{i} : int;")
+    # every nested function sees all of the locals above it
+    for j in range(10):
+        out.append(f"  fun g{j}() : nothing {{ l{j * n // 10} <- l{(j * n // 10 + 1) % n} + 1; }}")
+    out.append("{")
+    out.append("  l0 <- 0;")
+    for i in range(1, n):
+        out.append(f"  l{i} <- l{i - 1} + 1;")
+    for j in range(10):
+        out.append(f"  g{j}();")
+    out.append(f"  writeInteger(l{n - 1} mod 1000); writeChar('\\n');")
+    out.append("}")
+    return out
+
+
+def expr(n):
+    terms = " ".join(f"{'+' if i % 2 else '-'} {i % 7} * x" for i in range(1, n))
+    return [
+        "fun main() : nothing",
+        "  var x, y : int;",
+        "{",
+        "  x <- readInteger();",
+        f"  y <- x {terms};",
+        "  writeInteger(y mod 1000); writeChar('\\n');",
+        "}",
+    ]
+
+
+def args(n):
+    params = ", ".join(f"a{i}" for i in range(n))
+    values = ", ".join(str(i % 10) for i in range(n))
+    return [
+        "fun main() : nothing",
+        f"  fun f({params} : int) : int",
+        f"  {{ return a0 + a{n - 1}; }}",
+        "{",
+        f"  writeInteger(f({values})); writeChar('\\n');",
+        "}",
+    ]
+
+
+def string(n):
+    text = "".join("abcdefghij"[i % 10] for i in range(n))
+    out = ["fun main() : nothing", "{"]
+    for _ in range(4):
+        out.append(f'  writeString("{text}\\n");')
+    out.append("}")
+    return out
+
+
+def comments(n):
+    out = [
+        "$$ A program that is mostly comments and blanks, like a well",
+        "   documented one, to measure the scanner more than the rest. $$",
+        "fun main() : nothing",
+        "  var s : int;    $ the running sum",
+    ]
+    for i in range(n):
+        out.append(f"  $$ f{i} adds {i % 10} to its argument.")
+        out.append("     It is called once, from the body of main. $$")
+        out.append(f"  fun f{i}(x : int) : int")
+        out.append("  {")
+        out.append(f"    return x + {i % 10};    $ nothing else to do")
+        out.append("  }")
+        out.append("")
+    out.append("{")
+    out.append("  s <- 0;")
+    for i in range(n):
+        out.append(f"  s <- f{i}(s) mod 1000;    $ keep it small")
+    out.append("  writeInteger(s); writeChar('\\n');")
+    out.append("}")
+    return out
+
+
+SHAPES = {
+    "siblings": siblings,
+    "nesting": nesting,
+    "locals": locals,
+    "expr": expr,
+    "args": args,
+    "string": string,
+    "comments": comments,
+}
+
+
+def generate(shape, size):
+    return "\n".join(SHAPES[shape](size)) + "\n"
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3 or sys.argv[1] not in SHAPES or not sys.argv[2].isdigit() or int(sys.argv[2]) < 2:
+        sys.exit(f"Usage: {sys.argv[0]} <{' | '.join(SHAPES)}> <size >= 2>")
+    sys.stdout.write(generate(sys.argv[1], int(sys.argv[2])))
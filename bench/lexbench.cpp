@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "source.hpp"
+
+/*
+* Scans source files with the scanner it is linked with, without
+* parsing them, and prints the throughput of the scanner. make lexbench
+* links it once with each scanner and bench/lexspeed.py compares them.
+*
+* Usage: lexbench [-r <repeat>] <source_file>...
+*        lexbench -t <source_file>
+* Prints a line per file: name, bytes, tokens, median ms and MB/s. With
+* -t it prints the tokens of the file instead, one per line with their
+* line number and value, for the token streams of the two scanners to
+* be diffed.
+*/
+
+thread_local AtomTable atoms;
+thread_local Arena ast_arena;
+
+// the tokens of one scan of the whole file
+static long scan(SourceFile &source)
+{
+  yyscan_t scanner;
+  YYSTYPE yylval;
+  long tokens = 0;
+  yylex_init(&scanner);
+  yy_scan_buffer(source.buffer(), source.buffer_size(), scanner);
+  mylineno = 1;
+  while (yylex(&yylval, scanner) != 0)
+    tokens++;
+  yylex_destroy(scanner);
+  // the string literals
+  ast_arena.release();
+  return tokens;
+}
+
+// the value the parser gets with the token
+static void print_token(int token, const YYSTYPE &yylval)
+{
+  std::printf("%d %d", mylineno, token);
+  switch (token) {
+  case T_id:
+    std::printf(" %s", atoms.name(yylval.atom).c_str());
+    break;
+  case T_int_const:
+    std::printf(" %d", yylval.num);
+    break;
+  case T_char_const:
+    std::printf(" %d", yylval.charval);
+    break;
+  case T_string_literal:
+    std::putchar(' ');
+    for (char c : *yylval.stringval)
+      std::printf("%02x", (unsigned char)c);
+    break;
+  case T_and: case T_or: case T_div: case T_mod: case T_lessorequal: case T_greaterorequal:
+    std::printf(" %d", yylval.op);
+    break;
+  default:
+    if (token < 256)
+      std::printf(" %d", yylval.op);
+  }
+  std::putchar('\n');
+}
+
+static void dump(SourceFile &source)
+{
+  yyscan_t scanner;
+  YYSTYPE yylval;
+  int token;
+  yylex_init(&scanner);
+  yy_scan_buffer(source.buffer(), source.buffer_size(), scanner);
+  mylineno = 1;
+  while ((token = yylex(&yylval, scanner)) != 0)
+    print_token(token, yylval);
+  yylex_destroy(scanner);
+  ast_arena.release();
+}
+
+int main(int argc, char **argv)
+{
+  int repeat = 5;
+  int first = 1;
+  if (argc == 3 && std::strcmp(argv[1], "-t") == 0) {
+    SourceFile source;
+    if (!source.open(argv[2])) {
+      std::fprintf(stderr, "Could not open file: %s\n", argv[2]);
+      return 1;
+    }
+    dump(source);
+    return 0;
+  }
+  if (argc > 2 && std::strcmp(argv[1], "-r") == 0) {
+    repeat = std::atoi(argv[2]);
+    first = 3;
+  }
+  if (first >= argc || repeat < 1) {
+    std::fprintf(stderr, "Usage: %s [-r <repeat>] <source_file>...\n", argv[0]);
+    return 1;
+  }
+
+  for (int i = first; i < argc; i++) {
+    SourceFile source;
+    if (!source.open(argv[i])) {
+      std::fprintf(stderr, "Could not open file: %s\n", argv[i]);
+      return 1;
+    }
+    long tokens = 0;
+    std::vector<double> times;
+    for (int run = 0; run < repeat; run++) {
+      auto start = std::chrono::steady_clock::now();
+      tokens = scan(source);
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+      times.push_back(elapsed.count());
+    }
+    std::sort(times.begin(), times.end());
+    double ms = times[times.size() / 2];
+    double megabytes = source.text_size() / 1e6;
+    std::printf("%s %zu %ld %.3f %.1f\n", argv[i], source.text_size(), tokens, ms, ms > 0 ? megabytes / (ms / 1e3) : 0.0);
+  }
+  return 0;
+}
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""
+Compares the throughput of the two scanners of gracec, the flex one of
+lexer.l and the hand-written one of scanner.cpp, in MB/s. Both scan
+the same large programs of generate.py, one per shape, grown until
+they are at least --megabytes long, and must give the same tokens,
+values and line numbers on them. make lexbench builds the two
+lexbench binaries and runs this.
+
+Usage: lexspeed.py [--flex bench/lexbench-flex] [--simd bench/lexbench-simd]
+                   [--megabytes 8] [--repeat 5] [--shapes comments,siblings,...]
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import generate
+
+# nesting is left out, its indentation grows with the square of its size
+DEFAULT_SHAPES = "comments,siblings,locals,expr,args,string"
+
+
+def large_program(shape, megabytes):
+    size = 64
+    while True:
+        text = generate.generate(shape, size)
+        if len(text) >= megabytes * 1e6:
+            return text
+        size *= 2
+
+
+def throughput(lexbench, source, repeat):
+    result = subprocess.run([lexbench, "-r", str(repeat), source],
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+    if result.returncode != 0:
+        raise RuntimeError(f"{lexbench} failed on {source}:\n{result.stdout[-2000:]}{result.stderr[:2000]}")
+    _, size, tokens, ms, rate = result.stdout.split()
+    return int(size), int(tokens), float(ms), float(rate)
+
+
+def tokens(lexbench, source):
+    result = subprocess.run([lexbench, "-t", source],
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+    if result.returncode != 0:
+        raise RuntimeError(f"{lexbench} failed on {source}:\n{result.stderr[:2000]}")
+    return result.stdout.splitlines()
+
+
+# the first token where the two streams part, as "line token value"
+def first_difference(flex, simd):
+    for i, (f, s) in enumerate(zip(flex, simd)):
+        if f != s:
+            return f"token {i}: flex {f!r}, simd {s!r}"
+    if len(flex) != len(simd):
+        return f"flex has {len(flex)} tokens, simd {len(simd)}"
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Throughput of the scanners of gracec")
+    parser.add_argument("--flex", default="bench/lexbench-flex")
+    parser.add_argument("--simd", default="bench/lexbench-simd")
+    parser.add_argument("--megabytes", type=float, default=8)
+    parser.add_argument("--repeat", type=int, default=5)
+    parser.add_argument("--shapes", default=DEFAULT_SHAPES)
+    options = parser.parse_args()
+    status = 0
+
+    print(f"{'shape':<10} {'MB':>6} {'tokens':>10} {'flex MB/s':>10} {'simd MB/s':>10} {'speedup':>8}")
+    with tempfile.TemporaryDirectory() as work:
+        for shape in options.shapes.split(","):
+            source = os.path.join(work, f"{shape}.grc")
+            with open(source, "w") as f:
+                f.write(large_program(shape, options.megabytes))
+            difference = first_difference(tokens(options.flex, source), tokens(options.simd, source))
+            if difference:
+                print(f"{shape}: the scanners disagree, {difference}")
+                status = 1
+            size, flex_tokens, _, flex_rate = throughput(options.flex, source, options.repeat)
+            _, simd_tokens, _, simd_rate = throughput(options.simd, source, options.repeat)
+            print(f"{shape:<10} {size / 1e6:6.1f} {flex_tokens:10d} {flex_rate:10.1f} {simd_rate:10.1f} "
+                  f"{simd_rate / flex_rate if flex_rate else 0:8.2f}")
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,30 @@
+#include <stdio.h>
+
+static int a[200][200], b[200][200], c[200][200];
+
+static void multiply(int x[][200], int y[][200], int z[][200], int n)
+{
+  int i, j, k, s;
+  for (i = 0; i < n; i++)
+    for (j = 0; j < n; j++) {
+      s = 0;
+      for (k = 0; k < n; k++) s += x[i][k] * y[k][j];
+      z[i][j] = s % 9973;
+    }
+}
+
+int main(void)
+{
+  int i, j, round, sum;
+  for (i = 0; i < 200; i++)
+    for (j = 0; j < 200; j++) { a[i][j] = (i * j) % 7 + 1; b[i][j] = (i + j) % 5 + 1; }
+  for (round = 0; round < 4; round++) {
+    multiply(a, b, c, 200);
+    multiply(c, b, a, 200);
+  }
+  sum = 0;
+  for (i = 0; i < 200; i++)
+    for (j = 0; j < 200; j++) sum = (sum * 31 + a[i][j]) % 9973;
+  printf("%d\n", sum);
+  return 0;
+}
@@ -0,0 +1,68 @@
+#!/bin/bash
+#
+# Runtime benchmarks of the generated code: every bench/*.grc is built
+# at each optimization level, checked against the output of its C
+# version, and timed against it.
+#
+#   GRACEC   the compiler to measure (default ./gracec)
+#   CC       the C compiler of the baselines (default cc)
+#   LEVELS   the optimization levels to build (default "0 1 2 3")
+#   REPEAT   the runs of each program, of which the median counts (default 5)
+#
+# Run it from the top directory, where gracec finds lib.a. The
+# writeInteger of lib.a only prints 16-bit values, so the programs
+# print their results modulo 10000.
+
+GRACEC=${GRACEC:-./gracec}
+CC=${CC:-cc}
+LEVELS=${LEVELS:-0 1 2 3}
+REPEAT=${REPEAT:-5}
+BENCH=$(dirname "$0")
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+status=0
+
+# prints the median wall time of running $1, in milliseconds
+median_ms() {
+  local times=() start end
+  for ((run = 0; run < REPEAT; run++)); do
+    start=$(date +%s%N)
+    "$1" > /dev/null < /dev/null
+    end=$(date +%s%N)
+    times+=($(((end - start) / 1000000)))
+  done
+  printf '%s\n' "${times[@]}" | sort -n | sed -n "$(((REPEAT + 1) / 2))p"
+}
+
+printf '%-12s %-6s %10s %8s\n' program build median_ms vs_c
+for source in "$BENCH"/*.grc; do
+  name=$(basename "$source" .grc)
+  if ! $CC -O2 -o "$work/$name.c" "$BENCH/$name.c"; then
+    echo "$name: the C baseline does not compile"
+    status=1
+    continue
+  fi
+  "$work/$name.c" > "$work/$name.expected" < /dev/null
+  baseline=$(median_ms "$work/$name.c")
+  printf '%-12s %-6s %10d %8s\n' "$name" "C -O2" "$baseline" 1.00
+
+  for level in $LEVELS; do
+    program="$work/$name.O$level"
+    if ! "$GRACEC" -O$level -o "$program" "$source" 2> "$work/errors"; then
+      echo "$name: gracec -O$level failed"
+      head -20 "$work/errors"
+      status=1
+      continue
+    fi
+    if ! "$program" < /dev/null | cmp -s - "$work/$name.expected"; then
+      echo "$name: the output at -O$level differs from the C version"
+      status=1
+      continue
+    fi
+    time=$(median_ms "$program")
+    printf '%-12s %-6s %10d %8s\n' "$name" "-O$level" "$time" \
+      "$(awk -v t="$time" -v c="$baseline" 'BEGIN { printf "%.2f", c ? t / c : 0 }')"
+  done
+done
+exit $status
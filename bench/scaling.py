@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""
+Measures how each phase of gracec scales with the size of a program.
+For every shape of generate.py it compiles programs of growing sizes
+with -ftime-report and fits time = c * size^k to each phase by least
+squares on the logarithms. A k well above 1 means the phase does not
+scale linearly with that dimension of the program.
+
+Usage: scaling.py [--gracec ./gracec] [--sizes 200,400,800,1600]
+                  [--repeat 3] [--shapes siblings,nesting,...]
+"""
+
+import argparse
+import math
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import generate
+
+# the exponent above which a phase gets flagged
+SUPERLINEAR = 1.3
+
+
+def phase_times(gracec, source):
+    result = subprocess.run([gracec, "-ftime-report", "-c", source],
+                            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, universal_newlines=True)
+    if result.returncode != 0:
+        raise RuntimeError(f"{gracec} failed on {source}:\n{result.stderr[:2000]}")
+    times = {}
+    for line in result.stderr.splitlines():
+        match = re.match(r"\s+(\S+)\s+([0-9.]+)$", line)
+        if match:
+            times[match.group(1)] = float(match.group(2))
+    return times
+
+
+def median(values):
+    values = sorted(values)
+    return values[len(values) // 2]
+
+
+def fit_exponent(sizes, times):
+    points = [(math.log(s), math.log(t)) for s, t in zip(sizes, times) if t > 0]
+    if len(points) < 2:
+        return float("nan")
+    mx = sum(x for x, _ in points) / len(points)
+    my = sum(y for _, y in points) / len(points)
+    sxx = sum((x - mx) ** 2 for x, _ in points)
+    sxy = sum((x - mx) * (y - my) for x, y in points)
+    return sxy / sxx
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compile-time scaling of gracec")
+    parser.add_argument("--gracec", default="./gracec")
+    parser.add_argument("--sizes", default="200,400,800,1600")
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--shapes", default=",".join(generate.SHAPES))
+    options = parser.parse_args()
+    sizes = [int(s) for s in options.sizes.split(",")]
+    flagged = []
+
+    with tempfile.TemporaryDirectory() as work:
+        for shape in options.shapes.split(","):
+            # per phase, the median time at each size
+            table = {}
+            for size in sizes:
+                source = os.path.join(work, f"{shape}_{size}.grc")
+                with open(source, "w") as f:
+                    f.write(generate.generate(shape, size))
+                runs = [phase_times(options.gracec, source) for _ in range(options.repeat)]
+                for phase in runs[0]:
+                    table.setdefault(phase, []).append(median([run.get(phase, 0.0) for run in runs]))
+
+            print(f"{shape} (ms at sizes {', '.join(map(str, sizes))})")
+            for phase, times in table.items():
+                k = fit_exponent(sizes, times)
+                mark = ""
+                if k > SUPERLINEAR and phase != "total":
+                    mark = "  <- superlinear"
+                    flagged.append(f"{shape}/{phase}")
+                print(f"  {phase:<10} {' '.join(f'{t:10.2f}' for t in times)}   k = {k:.2f}{mark}")
+            print()
+
+    if flagged:
+        print("Superlinear: " + ", ".join(flagged))
+
+
+if __name__ == "__main__":
+    main()
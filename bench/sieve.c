@@ -0,0 +1,26 @@
+#include <stdio.h>
+
+static char composite[2000000];
+
+static int sieve(char *p, int n)
+{
+  int i, j, count;
+  for (i = 0; i < n; i++) p[i] = '\0';
+  count = 0;
+  for (i = 2; i < n; i++) {
+    if (p[i] == '\0') {
+      count++;
+      for (j = i + i; j < n; j += i) p[j] = 'x';
+    }
+  }
+  return count;
+}
+
+int main(void)
+{
+  int count = 0, round;
+  for (round = 0; round < 10; round++)
+    count += sieve(composite, 2000000);
+  printf("%d\n", count % 10000);
+  return 0;
+}
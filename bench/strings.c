@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <string.h>
+
+static void reverse(char *s)
+{
+  int i = 0, j = strlen(s) - 1;
+  char c;
+  for (; i < j; i++, j--) { c = s[i]; s[i] = s[j]; s[j] = c; }
+}
+
+int main(void)
+{
+  char a[256], b[256];
+  int i, j, same = 0, total = 0;
+  for (i = 0; i < 200000; i++) {
+    strcpy(a, "grace");
+    strcpy(b, "grace");
+    for (j = 0; j < 10; j++) { strcat(a, "-abc"); strcat(b, "-abc"); }
+    if (i % 3 == 0) strcat(b, "!");
+    reverse(a);
+    reverse(b);
+    if (strcmp(a, b) == 0) same++;
+    total += strlen(b);
+  }
+  printf("%d %d\n", same % 10000, total % 10000);
+  return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef __CACHE_HPP__
+#define __CACHE_HPP__
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Define global flags
+extern std::string cache_directory;
+extern uint64_t cache_size_limit;
+extern thread_local std::string cache_key;
+
+/*
+* On-disk cache of compiler outputs, addressed by a hash of everything
+* that affects them. Entries are written to a temporary file and renamed
+* into place, so concurrent compilers only ever see complete entries.
+* Files are named llvmcache-* so that llvm::pruneCache can evict them.
+*/
+class CompilationCache {
+public:
+  static std::string hash(const std::vector<std::string> &inputs) {
+    llvm::SHA1 hasher;
+    for (const auto &input : inputs) {
+      // the length keeps ("ab", "c") and ("a", "bc") apart
+      hasher.update(std::to_string(input.size()) + ":");
+      hasher.update(input);
+    }
+    return llvm::toHex(hasher.result(), true);
+  }
+
+  static bool lookup(const std::string &key, const std::string &kind, std::string &contents) {
+    llvm::SmallString<128> path = entry_path(key, kind);
+    int fd;
+    if (llvm::sys::fs::openFileForRead(path, fd))
+      return false;
+    auto buffer = llvm::MemoryBuffer::getOpenFile(fd, path, -1);
+    if (buffer) {
+      contents = std::string((*buffer)->getBuffer());
+      // pruning evicts the least recently used entries first
+      auto now = std::chrono::system_clock::now();
+      llvm::sys::fs::setLastAccessAndModificationTime(fd, now, now);
+    }
+    llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+    return bool(buffer);
+  }
+
+  static void store(const std::string &key, const std::string &kind, llvm::StringRef contents) {
+    if (llvm::sys::fs::create_directories(cache_directory))
+      return;
+    llvm::SmallString<128> model(cache_directory);
+    llvm::sys::path::append(model, "gracec-tmp-%%%%%%%%%%%%");
+    auto temp = llvm::sys::fs::TempFile::create(model);
+    if (!temp) {
+      llvm::consumeError(temp.takeError());
+      return;
+    }
+    {
+      llvm::raw_fd_ostream out(temp->FD, false);
+      out << contents;
+    }
+    // a failed store only costs a future cache miss
+    if (llvm::Error error = temp->keep(entry_path(key, kind)))
+      llvm::consumeError(std::move(error));
+
+    // the timestamp file of the cache keeps the directory walk to once
+    // every 20 minutes, however many files a batch stores
+    llvm::CachePruningPolicy policy;
+    policy.Interval = std::chrono::minutes(20);
+    policy.MaxSizeBytes = cache_size_limit;
+    llvm::pruneCache(cache_directory, policy);
+  }
+
+private:
+  static llvm::SmallString<128> entry_path(const std::string &key, const std::string &kind) {
+    llvm::SmallString<128> path(cache_directory);
+    llvm::sys::path::append(path, "llvmcache-" + key + "." + kind);
+    return path;
+  }
+};
+
+#endif
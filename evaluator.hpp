@@ -0,0 +1,95 @@
+#ifndef __EVALUATOR_HPP__
+#define __EVALUATOR_HPP__
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "vm.hpp"
+
+/*
+* Evaluates the calls of pure functions with constant arguments while
+* the program is compiled. sem finds the pure functions: the ones that
+* touch only their own frame and what their parameters point to, call
+* only pure functions and do no I/O. Each one is lowered to the bytecode
+* of the evaluator as soon as it is folded, since its AST goes back to
+* the arena right after. A call runs on the VM with a budget of steps
+* and a smaller stack; one that fails or runs out of either stays in
+* the program, to do the same at run time.
+*/
+class Evaluator {
+public:
+  // the calls and loop iterations of each function, in one evaluation
+  static const uint32_t step_limit = 1 << 16;
+  static const int32_t stack_limit = 1024 * 1024;
+
+  Evaluator() { builder.count_loops = true; }
+
+  // where the pure functions get lowered, with add_function and bind_function
+  BytecodeBuilder builder;
+
+  bool call(int index, const std::vector<int32_t> &args, int32_t &result)
+  {
+    if (given_up.count(index))
+      return false;
+    std::vector<int32_t> key(args);
+    key.push_back(index);
+    auto it = results.find(key);
+    if (it == results.end()) {
+      // the vm has the functions there were when it started
+      if (!vm || functions != builder.program.functions.size() || constants != builder.program.constants.size())
+        start();
+      out_of_steps = false;
+      Result r;
+      r.done = vm->call(index, args.data(), r.value);
+      // a function too slow for one call is likely too slow for the rest
+      if (out_of_steps)
+        given_up.insert(index);
+      it = results.emplace(key, r).first;
+    }
+    result = it->second.value;
+    return it->second.done;
+  }
+
+  // forgets the functions of the last compilation
+  void clear()
+  {
+    vm.reset();
+    builder = BytecodeBuilder();
+    builder.count_loops = true;
+    results.clear();
+    given_up.clear();
+  }
+
+private:
+  struct Result {
+    bool done;
+    int32_t value;
+  };
+
+  std::unique_ptr<VM> vm;
+  size_t functions = 0;
+  size_t constants = 0;
+  bool out_of_steps = false;
+  std::map<std::vector<int32_t>, Result> results;
+  std::set<int> given_up;
+
+  void start()
+  {
+    vm.reset(new VM(builder.program));
+    vm->set_stack_limit(stack_limit);
+    vm->set_hot_callback(step_limit, [this](int) {
+      out_of_steps = true;
+      VM::fail();
+    });
+    functions = builder.program.functions.size();
+    constants = builder.program.constants.size();
+  }
+};
+
+// Every thread evaluates the calls of the program it compiles
+extern thread_local Evaluator evaluator;
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __JIT_HPP__
+#define __JIT_HPP__
+
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#include "runtime.hpp"
+
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/TargetSelect.h"
+
+// Define global flags
+extern bool run_program;
+
+/*
+* Runs a compiled program inside the compiler with ORC LLJIT.
+* The object code is the one we would otherwise link, so the
+* program is only compiled once; the runtime library calls
+* are bound to the in-process Runtime.
+*/
+class JIT {
+public:
+  static int run_object(llvm::StringRef object)
+  {
+    // a cached object can get here without the compiler setting up any target
+    static std::once_flag target_initialized;
+    std::call_once(target_initialized, []() {
+      llvm::InitializeNativeTarget();
+      llvm::InitializeNativeTargetAsmPrinter();
+    });
+
+    auto J = llvm::orc::LLJITBuilder().create();
+    if (!J)
+      fail(J.takeError());
+
+    llvm::orc::JITDylib &JD = (*J)->getMainJITDylib();
+    llvm::orc::MangleAndInterner Mangle((*J)->getExecutionSession(), (*J)->getDataLayout());
+    llvm::orc::SymbolMap runtime;
+    for (const auto &symbol : Runtime::symbols())
+      runtime[Mangle(symbol.first)] =
+        llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(symbol.second), llvm::JITSymbolFlags::Exported);
+    if (llvm::Error error = JD.define(llvm::orc::absoluteSymbols(runtime)))
+      fail(std::move(error));
+
+    // the optimizer may still emit calls to memset, memcpy and the like
+    auto process = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+      (*J)->getDataLayout().getGlobalPrefix());
+    if (!process)
+      fail(process.takeError());
+    JD.addGenerator(std::move(*process));
+
+    if (llvm::Error error = (*J)->addObjectFile(llvm::MemoryBuffer::getMemBufferCopy(object)))
+      fail(std::move(error));
+    auto main = (*J)->lookup("main");
+    if (!main)
+      fail(main.takeError());
+
+    auto *entry = (int (*)())main->getAddress();
+    int status = entry();
+    std::fflush(stdout);
+    return status;
+  }
+
+private:
+  [[noreturn]] static void fail(llvm::Error error)
+  {
+    std::cerr << "Could not run the program: " << llvm::toString(std::move(error)) << std::endl;
+    exit(1);
+  }
+};
+
+#endif
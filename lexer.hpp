@@ -1,11 +1,44 @@
 #ifndef __LEXER_HPP__
 #define __LEXER_HPP__
 #include <string>
+#include <cstdio>
+#include <cstddef>
+#include "arena.hpp"
 
-int yylex();
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+
+#ifndef YY_TYPEDEF_YY_BUFFER_STATE
+#define YY_TYPEDEF_YY_BUFFER_STATE
+typedef struct yy_buffer_state *YY_BUFFER_STATE;
+#endif
+
+union YYSTYPE;
+
+/*
+* The interface of the scanner to the parser. It is implemented both
+* by the flex scanner of lexer.l and by the hand-written one of
+* scanner.cpp, and the Makefile links in one of them (SCANNER=flex or
+* SCANNER=simd). The buffer given to yy_scan_buffer ends in two NULs.
+* What the two share, from the error messages to the decoding of the
+* literals, is defined in lexer_util.cpp.
+*/
+int yylex(YYSTYPE *yylval_param, yyscan_t yyscanner);
+int yylex_init(yyscan_t *scanner);
+int yylex_destroy(yyscan_t scanner);
+YY_BUFFER_STATE yy_scan_buffer(char *base, size_t size, yyscan_t scanner);
 void yyerror(const char *msg);
+void yyerror(yyscan_t scanner, const char *msg);
+void yyerror2(const char *msg, int lineno);
+int get_int_const(const char *str, int len);
 char get_escape_char(char c1, char c2);
 char get_char_from_hex(char c1, char c2);
-std::string *get_string(char *str, int len);
+// decodes a string literal into the arena
+ArenaString *get_string(const char *str, int len);
+
+// the line the scanner is on
+extern thread_local int mylineno;
 
 #endif
@@ -0,0 +1,86 @@
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include "lexer.hpp"
+
+/*
+* What the two scanners have in common: the line they are on, the
+* error messages and the decoding of escape sequences.
+*/
+thread_local int mylineno = 1;
+
+/*
+* With -j the other workers are still compiling when one of them finds
+* an error, and exit would run the destructors of the globals they use.
+* _Exit ends the process without touching them, so what has been
+* printed so far is flushed by hand. Every error that ends a
+* compilation goes through here.
+*/
+void error_exit() {
+    fflush(stdout);
+    fflush(stderr);
+    std::_Exit(1);
+}
+
+void yyerror2(const char* msg, int lineno) {
+    fprintf(stderr, "Error at line %d: %s\n", lineno, msg);
+    error_exit();
+}
+
+void yyerror(const char* msg) {
+    fprintf(stderr, "Error at line %d:\n%s\n", mylineno, msg);
+    error_exit();
+}
+
+char get_escape_char(char c1, char c2) {
+  if(c2 == 'n') return '\n';
+  if(c2 == 't') return '\t';
+  if(c2 == 'r') return '\r';
+  if(c2 == '0') return '\0';
+  if(c2 == '\\') return '\\';
+  if(c2 == '\'') return '\'';
+  if(c2 == '\"') return '\"';
+  return c1; //won't be reached
+}
+
+// a constant too large for an int wraps around, like the arithmetic does
+int get_int_const(const char *str, int len) {
+  unsigned value = 0;
+  for (int i = 0; i < len; i++)
+    value = value * 10 + (str[i] - '0');
+  return value;
+}
+
+char get_char_from_hex(char c1, char c2) {
+  return std::stoi(std::string(1, c1), 0, 16)*16 + std::stoi(std::string(1, c2), 0, 16);
+}
+
+ArenaString *get_string(const char *str, int len) {
+  ArenaString *stringval = ast_arena.make<ArenaString>(str, len);
+  size_t pos = stringval->find("\\", 0);
+    while(pos != std::string::npos) {
+      if(stringval->at(pos + 1) == 'x') {
+        stringval->replace(pos, 4, ArenaString(1, get_char_from_hex(stringval->at(pos + 2), stringval->at(pos + 3))));
+      }
+      else if(stringval->at(pos + 1) == 'n') {
+        stringval->replace(pos, 2, "\n");
+      }
+      else if(stringval->at(pos + 1) == 't') {
+        stringval->replace(pos, 2, "\t");
+      }
+      else if(stringval->at(pos + 1) == 'r') {
+        stringval->replace(pos, 2, "\r");
+      }
+      else if(stringval->at(pos + 1) == '\\') {
+        stringval->replace(pos, 2, "\\");
+      }
+      else if(stringval->at(pos + 1) == '\'') {
+        stringval->replace(pos, 2, "\'");
+      }
+      else if(stringval->at(pos + 1) == '\"') {
+        stringval->replace(pos, 2, "\"");
+      }
+      pos = stringval->find("\\", pos + 1);
+    }
+    return stringval;
+}
@@ -1,17 +1,27 @@
 %code requires{
     #include <string>
     #include "ast.hpp"
+    #include "source.hpp"
+    #ifndef YY_TYPEDEF_YY_SCANNER_T
+    #define YY_TYPEDEF_YY_SCANNER_T
+    typedef void *yyscan_t;
+    #endif
     }
 
 %{
 #include <cstdio>
+#include <atomic>
+#include <thread>
 #include "lexer.hpp"
 #include "ast.hpp"
 
-extern int mylineno;
-SymbolTable st;
+extern thread_local int mylineno;
+thread_local SymbolTable st;
 %}
 
+%define api.pure full
+%param {yyscan_t scanner}
+
 
 %token T_int "int"
 %token T_char "char"
@@ -24,7 +34,7 @@ SymbolTable st;
 %token T_if "if"
 %token T_return "return"
 %token T_assign "<-"
-%token<var> T_id
+%token<atom> T_id
 %token<num> T_int_const
 %token<charval> T_char_const
 %token<stringval> T_string_literal
@@ -46,10 +56,10 @@ SymbolTable st;
   Stmt *stmt;
   Expr *expr;
   int num;
-  std::string *var;
+  Atom atom;
   char op;
   char charval;
-  std::string *stringval;
+  ArenaString *stringval;
   DataType data_type;
   ArrayDimension *dimension;
   VariableType *t_variable_type;
@@ -74,30 +84,30 @@ SymbolTable st;
 %type<t_header> header
 %type<t_func_param_list> func_param_def func_param_def_list
 %type<t_id_list> id_list
-%type<t_local_definition_list> local_def var_def local_def_list
+%type<t_local_definition_list> local_def var_def
 %type<t_function_declaration> func_decl
 %type<t_function_definition> func_def
 
 %%
 
 program:
-  func_def { 
-    //std::cout << "AST: " << *$1 << std::endl;
-    //delete $1;
-    $1->sem();
-    //delete $1;
-    $1->llvm_compile_and_dump();
-    delete $1;
-    }
+  { FunctionDefinition::begin_program(); } func_def { $$ = $2; $2->end_program(); }
 ;
 
+/*
+* Each function is checked and compiled as soon as the parser gets
+* through it, and its AST is freed, so that only the functions it is
+* nested in are in memory at any time
+*/
 func_def:
-  header local_def_list block { $$ = new FunctionDefinition($1,$2,$3, mylineno);}
+  header { $<t_function_definition>$ = new FunctionDefinition($1); $<t_function_definition>$->open(); }
+  local_def_list block { $$ = $<t_function_definition>2; $$->close($4, mylineno); }
 ;
 
+// $0 is the function the definitions are local to
 local_def_list:
-  /* nothing */ { $$ = new LocalDefinitionList(); }
-| local_def_list local_def { $1->join($2); $$ = $1; }
+  /* nothing */ {}
+| local_def_list local_def { $<t_function_definition>0->define($2); }
 ;
 
 header:
@@ -107,7 +117,7 @@ header:
 
 func_param_def_list:
   func_param_def  { $$ = $1; }
-| func_param_def ';' func_param_def_list { $1->join($3); $$ = $1; }
+| func_param_def_list ';' func_param_def { $1->join($3); $$ = $1; }
 ;
 
 func_param_def:
@@ -116,8 +126,8 @@ func_param_def:
 ;
 
 id_list:
-  T_id { $$ = new IdList(new std::string("user_"+*$1)); }
-| T_id ',' id_list { $3->append_id(new std::string("user_"+*$1)); $$ = $3; }
+  T_id { $$ = new IdList(atoms.user($1)); }
+| id_list ',' T_id { $1->append_id(atoms.user($3)); $$ = $1; }
 ;
 
 data_type:
@@ -177,7 +187,7 @@ block:
 
 expr_list:
   expr { $$ = new ExpressionList($1); }
-| expr ',' expr_list { $3->add_expression($1); $$ = $3; }
+| expr_list ',' expr { $1->add_expression($3); $$ = $1; }
 ;
 
 func_call:
@@ -191,7 +201,7 @@ func_call_stmt:
 ;
 
 l_value:
-  T_id { $$ = new Id(new std::string("user_"+*$1), mylineno); }
+  T_id { $$ = new Id(atoms.user($1), mylineno); }
 | T_string_literal { $$ = new StringLiteral($1, mylineno); }
 | l_value '[' expr ']' { $$ = new ArrayAccess($1, $3); }
 ;
@@ -227,16 +237,105 @@ cond:
 
 
 %%
-extern FILE *yyin;
+
+void yyerror(yyscan_t scanner, const char *msg) {
+  yyerror(msg);
+}
+
+/*
+* Parses, checks and compiles a single source file.
+* In batch mode it is called once per file by the same process,
+* possibly from several worker threads at the same time.
+*/
+int compile_file(const std::string &filename) {
+  std::string::size_type idx = filename.rfind('.');
+  filepath = filename.substr(0, idx);
+
+  // the scanner reads the mapping in place, the tokens point into it
+  SourceFile source;
+  if (!source.open(filename)) {
+      std::cerr << "Could not open file: " << filename << std::endl;
+      return 1;
+  }
+
+  // the interpreter has no outputs to cache
+  if (!cache_directory.empty() && !interpret_program) {
+    cache_key = AST::get_cache_key(llvm::StringRef(source.text(), source.text_size()));
+    if (AST::write_cached_outputs()) return 0;
+  }
+
+  yyscan_t scanner;
+  yylex_init(&scanner);
+  yy_scan_buffer(source.buffer(), source.buffer_size(), scanner);
+  st.clear();
+  mylineno = 1;
+  int result;
+  {
+    PhaseTimer timer("parse");
+    result = yyparse(scanner);
+    yylex_destroy(scanner);
+  }
+  // the whole AST of the file, in one go
+  ast_arena.release();
+  if (time_report)
+    PhaseTimer::report(filename);
+  return result;
+}
+
+/*
+* Compiles the files on a pool of worker threads. Each worker
+* has its own LLVM context, module, symbol table and scanner.
+*/
+int compile_files_parallel(const std::vector<std::string> &filenames, unsigned jobs) {
+  std::atomic<size_t> next(0);
+  std::atomic<int> result(0);
+  std::vector<std::thread> workers;
+  for (unsigned j = 0; j < jobs && j < filenames.size(); ++j) {
+    workers.emplace_back([&]() {
+      size_t i;
+      while ((i = next++) < filenames.size()) {
+        if (compile_file(filenames[i]) != 0)
+          result = 1;
+      }
+      AST::release_llvm_state();
+    });
+  }
+  for (auto &worker : workers)
+    worker.join();
+  return result;
+}
+
+/*
+* Appends the source files listed in a manifest, one per line.
+* Empty lines and lines starting with '#' are skipped.
+*/
+bool read_manifest(const std::string &manifest, std::vector<std::string> &filenames) {
+  std::ifstream in(manifest);
+  if (!in) {
+    std::cerr << "Could not open manifest: " << manifest << std::endl;
+    return false;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty() || line[0] == '#') continue;
+    filenames.push_back(line);
+  }
+  return true;
+}
 
 int main(int argc, char** argv) {
   bool usage_error = false;
-  std::string filename;
+  bool batch = false;
+  unsigned jobs = 1;
+  std::vector<std::string> filenames;
 
   for (int i = 1; i < argc; ++i) {
     std::string arg = argv[i];
     if (arg == "-O") {
-      optimize = true;
+      optimization_level = 1;
+    } else if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0' && arg[2] <= '3') {
+      optimization_level = arg[2] - '0';
     } else if (arg == "-f") {
       if (intermediate_code_stdout) {
 	usage_error = true;
@@ -249,32 +348,109 @@ int main(int argc, char** argv) {
 	break;
       }
       intermediate_code_stdout = true;
-    } else if (filename.empty()) {
-      filename = arg;
-      std::string::size_type idx = filename.rfind('.');
-      filepath = filename.substr(0, idx);
+    } else if (arg == "-ftime-report") {
+      time_report = true;
+    } else if (arg == "-fstreaming-opt") {
+      streaming_optimization = true;
+    } else if (arg == "-fbounds-check") {
+      bounds_check = true;
+    } else if (arg.compare(0, 6, "-mcpu=") == 0) {
+      target_cpu = arg.substr(6);
+    } else if (arg.compare(0, 7, "-march=") == 0) {
+      target_cpu = arg.substr(7);
+    } else if (arg.compare(0, 7, "-mattr=") == 0) {
+      target_features = arg.substr(7);
+    } else if (arg == "-fcache") {
+      llvm::SmallString<128> path;
+      if (!llvm::sys::path::cache_directory(path)) {
+	std::cerr << "Could not find a cache directory, use -fcache-dir=<dir>" << std::endl;
+	return 1;
+      }
+      llvm::sys::path::append(path, "gracec");
+      cache_directory = std::string(path);
+    } else if (arg.compare(0, 12, "-fcache-dir=") == 0) {
+      cache_directory = arg.substr(12);
+    } else if (arg.compare(0, 13, "-fcache-size=") == 0) {
+      cache_size_limit = std::strtoull(arg.substr(13).c_str(), nullptr, 10) * 1024 * 1024;
+    } else if (arg == "-c") {
+      object_code_output = true;
+    } else if (arg == "-o") {
+      if (i + 1 >= argc) {
+	usage_error = true;
+	break;
+      }
+      executable_path = argv[++i];
+    } else if (arg == "--run") {
+      run_program = true;
+    } else if (arg == "--interpret") {
+      interpret_program = true;
+    } else if (arg == "--tiered") {
+      interpret_program = true;
+      tiered_execution = true;
+    } else if (arg.compare(0, 17, "-ftier-threshold=") == 0) {
+      tier_threshold = std::strtoul(arg.substr(17).c_str(), nullptr, 10);
+      if (tier_threshold == 0) {
+	usage_error = true;
+	break;
+      }
+    } else if (arg == "--batch") {
+      batch = true;
+    } else if (arg.compare(0, 2, "-j") == 0) {
+      std::string value = arg.substr(2);
+      if (value.empty() && i + 1 < argc)
+        value = argv[++i];
+      jobs = std::atoi(value.c_str());
+      if (jobs == 0) {
+	usage_error = true;
+	break;
+      }
+      batch = true;
+    } else if (batch && arg[0] == '@') {
+      if (!read_manifest(arg.substr(1), filenames)) return 1;
     } else {
-      usage_error = true;
+      filenames.push_back(arg);
     }
   }
 
-  if (filename.empty()) {
+  if (filenames.empty() || (!batch && filenames.size() > 1)) {
+    usage_error = true;
+  }
+
+  if ((object_code_output || !executable_path.empty()) && (final_code_stdout || intermediate_code_stdout)) {
+    usage_error = true;
+  }
+
+  if ((run_program || interpret_program) && (object_code_output || !executable_path.empty() || final_code_stdout || intermediate_code_stdout)) {
+    usage_error = true;
+  }
+
+  if (run_program && interpret_program) {
+    usage_error = true;
+  }
+
+  // a single output file can't hold more than one program
+  if (!executable_path.empty() && filenames.size() > 1) {
+    usage_error = true;
+  }
+
+  // the programs would be printed interleaved
+  if (jobs > 1 && (final_code_stdout || intermediate_code_stdout || run_program || interpret_program)) {
     usage_error = true;
   }
 
   if (usage_error) {
-    std::cerr << "Usage: " << argv[0] << "[-O] [-f | -i] <source_file.grc>" << std::endl;
+    std::cerr << "Usage: " << argv[0] << " [-O | -O0 | -O1 | -O2 | -O3] [-fstreaming-opt] [-fbounds-check] [-ftime-report] [-mcpu=<cpu> | -march=native] [-mattr=<features>] [-fcache | -fcache-dir=<dir>] [-fcache-size=<MB>] [-f | -i | -c | -o <executable> | --run | --interpret | --tiered] [-ftier-threshold=<n>] <source_file.grc>" << std::endl;
+    std::cerr << "       " << argv[0] << " --batch [-j <jobs>] [options] <source_file.grc | @manifest>..." << std::endl;
     return 1;
   }
 
-  FILE *file = fopen(filename.c_str(), "r");
+  if (jobs > 1)
+    return compile_files_parallel(filenames, jobs);
 
-  if (!file) {
-      std::cerr << "Could not open file: " << filename << std::endl;
-      return 1;
+  for (const auto &filename : filenames) {
+    int result = compile_file(filename);
+    //if (result == 0) printf("Success.\n");
+    if (result != 0) return result;
   }
-  yyin = file;
-  int result = yyparse();
-  //if (result == 0) printf("Success.\n");
-  return result;
+  return 0;
 }
@@ -0,0 +1,124 @@
+#ifndef __RANGE_HPP__
+#define __RANGE_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+
+class STEntry;
+
+/*
+* The values an int or char expression can have, for -fbounds-check to
+* leave out the checks of the indices that are always in bounds. The
+* bounds are 64-bit, so that the sum or the product of two 32-bit ones
+* is exact; a result that does not fit in 32 bits could wrap around at
+* run time, and can then be anything.
+*/
+struct Interval {
+  int64_t lo, hi;
+
+  static Interval all() { return { INT32_MIN, INT32_MAX }; }
+  static Interval of(int64_t value) { return { value, value }; }
+
+  static Interval make(int64_t lo, int64_t hi)
+  {
+    if (lo < INT32_MIN || hi > INT32_MAX)
+      return all();
+    return { lo, hi };
+  }
+
+  bool empty() const { return lo > hi; }
+  bool within(int64_t l, int64_t h) const { return lo >= l && hi <= h; }
+
+  Interval join(const Interval &other) const
+  {
+    return { std::min(lo, other.lo), std::max(hi, other.hi) };
+  }
+
+  bool operator==(const Interval &other) const { return lo == other.lo && hi == other.hi; }
+};
+
+/*
+* The intervals of the variables of a function at a point of its body.
+* Only the variables that no one else can change are in it: the ones
+* the function alone assigns, and never passes by reference. Any other,
+* or one not assigned yet, can be anything. A point that is never
+* reached, after a return or in a branch that is never taken, has no
+* values at all, which joins with the others as nothing.
+*/
+class RangeEnv {
+public:
+  bool reachable = true;
+
+  Interval get(const STEntry *variable) const
+  {
+    auto it = values.find(variable);
+    return it == values.end() ? Interval::all() : it->second;
+  }
+
+  // an empty interval means the point is never reached
+  void set(const STEntry *variable, Interval value)
+  {
+    if (value.empty())
+      reachable = false;
+    else
+      values[variable] = value;
+  }
+
+  // where either the one or the other of two paths gets to
+  void join(const RangeEnv &other)
+  {
+    if (!other.reachable)
+      return;
+    if (!reachable) {
+      *this = other;
+      return;
+    }
+    for (auto it = values.begin(); it != values.end();) {
+      auto found = other.values.find(it->first);
+      if (found == other.values.end()) {
+        it = values.erase(it);
+        continue;
+      }
+      it->second = it->second.join(found->second);
+      ++it;
+    }
+  }
+
+  /*
+  * The head of a loop, from its last state and the next one: the
+  * bounds that move go all the way, so that the loop is done with
+  * in a few iterations of the analysis
+  */
+  void widen(const RangeEnv &next)
+  {
+    if (!reachable) {
+      *this = next;
+      return;
+    }
+    for (auto it = values.begin(); it != values.end();) {
+      auto found = next.values.find(it->first);
+      if (found == next.values.end()) {
+        it = values.erase(it);
+        continue;
+      }
+      if (found->second.lo < it->second.lo)
+        it->second.lo = INT32_MIN;
+      if (found->second.hi > it->second.hi)
+        it->second.hi = INT32_MAX;
+      ++it;
+    }
+  }
+
+  bool operator==(const RangeEnv &other) const
+  {
+    return reachable == other.reachable && (!reachable || values == other.values);
+  }
+
+  bool operator!=(const RangeEnv &other) const { return !(*this == other); }
+
+private:
+  std::map<const STEntry *, Interval> values;
+};
+
+#endif
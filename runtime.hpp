@@ -0,0 +1,88 @@
+#ifndef __RUNTIME_HPP__
+#define __RUNTIME_HPP__
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <map>
+#include <string>
+
+/*
+* In-process implementation of the Grace runtime library,
+* with the same signatures and behaviour as the functions of lib.a
+* that AST::init_library declares. Programs that are executed
+* inside the compiler call these instead of linking lib.a.
+*/
+class Runtime {
+public:
+  static void writeInteger(int32_t n) { std::printf("%d", n); }
+  static void writeChar(char c) { std::putchar(c); }
+  static void writeString(const char *s) { std::fputs(s, stdout); }
+
+  static int32_t readInteger()
+  {
+    char line[256];
+    readString(sizeof(line), line);
+    return std::strtol(line, nullptr, 10);
+  }
+
+  static char readChar()
+  {
+    std::fflush(stdout);
+    int c = std::getchar();
+    return c == EOF ? 0 : c;
+  }
+
+  // reads a line of at most n - 1 characters, without the newline
+  static void readString(int32_t n, char *s)
+  {
+    std::fflush(stdout);
+    int i = 0, c;
+    while (i < n - 1 && (c = std::getchar()) != EOF && c != '\n')
+      s[i++] = c;
+    if (n > 0)
+      s[i] = '\0';
+  }
+
+  static int32_t ord(char c) { return (unsigned char)c; }
+  static char chr(int32_t n) { return n & 0xff; }
+
+  static int32_t strlen(const char *s)
+  {
+    int32_t n = 0;
+    while (s[n]) n++;
+    return n;
+  }
+
+  static int32_t strcmp(const char *s1, const char *s2)
+  {
+    while (*s1 && *s1 == *s2) s1++, s2++;
+    unsigned char c1 = *s1, c2 = *s2;
+    return c1 < c2 ? -1 : c1 > c2;
+  }
+
+  static void strcpy(char *trg, const char *src)
+  {
+    while ((*trg++ = *src++));
+  }
+
+  static void strcat(char *trg, const char *src)
+  {
+    strcpy(trg + strlen(trg), src);
+  }
+
+  // The addresses of the functions, by the names the programs call them
+  static std::map<std::string, void *> symbols()
+  {
+    return {
+      { "writeInteger", (void *)&writeInteger }, { "writeChar", (void *)&writeChar },
+      { "writeString", (void *)&writeString }, { "readInteger", (void *)&readInteger },
+      { "readChar", (void *)&readChar }, { "readString", (void *)&readString },
+      { "ord", (void *)&ord }, { "chr", (void *)&chr },
+      { "strlen", (void *)&strlen }, { "strcmp", (void *)&strcmp },
+      { "strcpy", (void *)&strcpy }, { "strcat", (void *)&strcat }
+    };
+  }
+};
+
+#endif
@@ -0,0 +1,432 @@
+#include <cstdint>
+#include <cstring>
+#include "lexer.hpp"
+#include "parser.hpp"
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#define SCANNER_X86 1
+#endif
+
+/*
+* A hand-written scanner for the same language as lexer.l, behind the
+* same yylex interface, for builds with SCANNER=simd. The runs that take
+* most of the bytes of a source file (blanks, comments, identifiers and
+* the plain characters of string literals) are skipped 16 or 32 bytes
+* at a time with SSE2 or AVX2, whichever the cpu has. The tokens
+* themselves, and whatever is left at the end of the buffer, are
+* scanned one byte at a time.
+*/
+
+namespace {
+
+struct Scanner {
+  const char *cursor;
+  // the first of the two NUL bytes that end the buffer
+  const char *end;
+};
+
+/*
+* Each kernel returns the first byte at or after p that ends its run,
+* or end. The ones that can cross lines add the newlines they skip.
+*/
+struct Kernels {
+  const char *(*skip_blanks)(const char *p, const char *end, int &newlines);
+  const char *(*find_newline)(const char *p, const char *end);
+  // the first "$$", as a block comment can't contain one
+  const char *(*find_comment_end)(const char *p, const char *end, int &newlines);
+  const char *(*skip_identifier)(const char *p, const char *end);
+  // the first character a string literal can't contain as it is: a quote, a backslash or a control character
+  const char *(*skip_string_chars)(const char *p, const char *end);
+};
+
+inline bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+inline bool is_letter(char c) { return (c | 0x20) >= 'a' && (c | 0x20) <= 'z'; }
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+inline bool is_hex_digit(char c) { return is_digit(c) || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f'); }
+inline bool is_identifier_char(char c) { return is_letter(c) || is_digit(c) || c == '_'; }
+// COMMONCHAR of lexer.l
+inline bool is_common_char(char c) { return c >= ' ' && c <= '~' && c != '"' && c != '\'' && c != '\\'; }
+
+const char *scalar_skip_blanks(const char *p, const char *end, int &newlines)
+{
+  for (; p < end && is_blank(*p); p++)
+    newlines += *p == '\n';
+  return p;
+}
+
+const char *scalar_find_newline(const char *p, const char *end)
+{
+  const void *newline = std::memchr(p, '\n', end - p);
+  return newline ? (const char *)newline : end;
+}
+
+const char *scalar_find_comment_end(const char *p, const char *end, int &newlines)
+{
+  for (; p < end && !(p[0] == '$' && p[1] == '$'); p++)
+    newlines += *p == '\n';
+  return p;
+}
+
+const char *scalar_skip_identifier(const char *p, const char *end)
+{
+  while (p < end && is_identifier_char(*p))
+    p++;
+  return p;
+}
+
+const char *scalar_skip_string_chars(const char *p, const char *end)
+{
+  while (p < end && is_common_char(*p))
+    p++;
+  return p;
+}
+
+#ifdef SCANNER_X86
+
+/*
+* Every x86-64 cpu has SSE2, so these need no check. Bytes are signed
+* in the comparisons, so the ones above 0x7f fall in no class.
+*/
+inline __m128i sse2_in_range(__m128i v, char low, char high)
+{
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(low - 1)), _mm_cmpgt_epi8(_mm_set1_epi8(high + 1), v));
+}
+
+const char *sse2_skip_blanks(const char *p, const char *end, int &newlines)
+{
+  for (; p + 16 <= end; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i newline = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+    __m128i blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), newline));
+    uint32_t newlines_mask = _mm_movemask_epi8(newline);
+    uint32_t stop = ~_mm_movemask_epi8(blank) & 0xffff;
+    if (stop) {
+      unsigned i = __builtin_ctz(stop);
+      newlines += __builtin_popcount(newlines_mask & ((1u << i) - 1));
+      return p + i;
+    }
+    newlines += __builtin_popcount(newlines_mask);
+  }
+  return scalar_skip_blanks(p, end, newlines);
+}
+
+const char *sse2_find_newline(const char *p, const char *end)
+{
+  for (; p + 16 <= end; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    uint32_t stop = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    if (stop)
+      return p + __builtin_ctz(stop);
+  }
+  return scalar_find_newline(p, end);
+}
+
+// the load at p + 1 may read the first NUL at end, never past it
+const char *sse2_find_comment_end(const char *p, const char *end, int &newlines)
+{
+  for (; p + 16 <= end; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i next = _mm_loadu_si128((const __m128i *)(p + 1));
+    __m128i dollar = _mm_set1_epi8('$');
+    uint32_t newlines_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    uint32_t stop = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v, dollar), _mm_cmpeq_epi8(next, dollar)));
+    if (stop) {
+      unsigned i = __builtin_ctz(stop);
+      newlines += __builtin_popcount(newlines_mask & ((1u << i) - 1));
+      return p + i;
+    }
+    newlines += __builtin_popcount(newlines_mask);
+  }
+  return scalar_find_comment_end(p, end, newlines);
+}
+
+const char *sse2_skip_identifier(const char *p, const char *end)
+{
+  for (; p + 16 <= end; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i letter = sse2_in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+    __m128i word = _mm_or_si128(_mm_or_si128(letter, sse2_in_range(v, '0', '9')), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    uint32_t stop = ~_mm_movemask_epi8(word) & 0xffff;
+    if (stop)
+      return p + __builtin_ctz(stop);
+  }
+  return scalar_skip_identifier(p, end);
+}
+
+const char *sse2_skip_string_chars(const char *p, const char *end)
+{
+  for (; p + 16 <= end; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\''))),
+                                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    __m128i common = _mm_andnot_si128(special, sse2_in_range(v, ' ', '~'));
+    uint32_t stop = ~_mm_movemask_epi8(common) & 0xffff;
+    if (stop)
+      return p + __builtin_ctz(stop);
+  }
+  return scalar_skip_string_chars(p, end);
+}
+
+/*
+* The same kernels with AVX2, compiled for it whatever the flags of the
+* build, and only called when the cpu has it.
+*/
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 inline __m256i avx2_in_range(__m256i v, char low, char high)
+{
+  return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(low - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(high + 1), v));
+}
+
+AVX2 const char *avx2_skip_blanks(const char *p, const char *end, int &newlines)
+{
+  for (; p + 32 <= end; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i newline = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+    __m256i blank = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')), newline));
+    uint32_t newlines_mask = _mm256_movemask_epi8(newline);
+    uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(blank);
+    if (stop) {
+      unsigned i = __builtin_ctz(stop);
+      newlines += __builtin_popcount(newlines_mask & ((1u << i) - 1));
+      return p + i;
+    }
+    newlines += __builtin_popcount(newlines_mask);
+  }
+  return sse2_skip_blanks(p, end, newlines);
+}
+
+AVX2 const char *avx2_find_newline(const char *p, const char *end)
+{
+  for (; p + 32 <= end; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    uint32_t stop = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+    if (stop)
+      return p + __builtin_ctz(stop);
+  }
+  return sse2_find_newline(p, end);
+}
+
+AVX2 const char *avx2_find_comment_end(const char *p, const char *end, int &newlines)
+{
+  for (; p + 32 <= end; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i next = _mm256_loadu_si256((const __m256i *)(p + 1));
+    __m256i dollar = _mm256_set1_epi8('$');
+    uint32_t newlines_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+    uint32_t stop = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(v, dollar), _mm256_cmpeq_epi8(next, dollar)));
+    if (stop) {
+      unsigned i = __builtin_ctz(stop);
+      newlines += __builtin_popcount(newlines_mask & ((1u << i) - 1));
+      return p + i;
+    }
+    newlines += __builtin_popcount(newlines_mask);
+  }
+  return sse2_find_comment_end(p, end, newlines);
+}
+
+AVX2 const char *avx2_skip_identifier(const char *p, const char *end)
+{
+  for (; p + 32 <= end; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i letter = avx2_in_range(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+    __m256i word = _mm256_or_si256(_mm256_or_si256(letter, avx2_in_range(v, '0', '9')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+    uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(word);
+    if (stop)
+      return p + __builtin_ctz(stop);
+  }
+  return sse2_skip_identifier(p, end);
+}
+
+AVX2 const char *avx2_skip_string_chars(const char *p, const char *end)
+{
+  for (; p + 32 <= end; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\''))),
+                                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+    __m256i common = _mm256_andnot_si256(special, avx2_in_range(v, ' ', '~'));
+    uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(common);
+    if (stop)
+      return p + __builtin_ctz(stop);
+  }
+  return sse2_skip_string_chars(p, end);
+}
+
+#undef AVX2
+
+#endif
+
+Kernels select_kernels()
+{
+#ifdef SCANNER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return {avx2_skip_blanks, avx2_find_newline, avx2_find_comment_end, avx2_skip_identifier, avx2_skip_string_chars};
+  return {sse2_skip_blanks, sse2_find_newline, sse2_find_comment_end, sse2_skip_identifier, sse2_skip_string_chars};
+#else
+  return {scalar_skip_blanks, scalar_find_newline, scalar_find_comment_end, scalar_skip_identifier, scalar_skip_string_chars};
+#endif
+}
+
+const Kernels kernels = select_kernels();
+
+struct Keyword {
+  const char *text;
+  int length;
+  int token;
+  char op;
+};
+
+const Keyword keywords[] = {
+  {"and", 3, T_and, '&'}, {"int", 3, T_int, 0}, {"then", 4, T_then, 0}, {"char", 4, T_char, 0},
+  {"mod", 3, T_mod, '%'}, {"var", 3, T_var, 0}, {"div", 3, T_div, '/'}, {"not", 3, T_not, 0},
+  {"while", 5, T_while, 0}, {"do", 2, T_do, 0}, {"nothing", 7, T_nothing, 0}, {"else", 4, T_else, 0},
+  {"or", 2, T_or, '|'}, {"fun", 3, T_fun, 0}, {"ref", 3, T_ref, 0}, {"if", 2, T_if, 0},
+  {"return", 6, T_return, 0},
+};
+
+// the length of the escape sequence at p (ESCAPESEQ or HEX of lexer.l), or 0
+int escape_length(const char *p)
+{
+  if (p[0] != '\\')
+    return 0;
+  if (p[1] != '\0' && std::strchr("ntr0\\'\"", p[1]))
+    return 2;
+  if (p[1] == 'x' && is_hex_digit(p[2]) && is_hex_digit(p[3]))
+    return 4;
+  return 0;
+}
+
+int scan(Scanner *s, YYSTYPE *yylval)
+{
+  const char *p = s->cursor;
+  const char *end = s->end;
+  for (;;) {
+    p = kernels.skip_blanks(p, end, mylineno);
+    if (p == end) {
+      s->cursor = p;
+      return 0;
+    }
+    if (p[0] != '$')
+      break;
+    if (p[1] == '$') {
+      // an unclosed comment is an error on the line it starts
+      int newlines = 0;
+      const char *close = kernels.find_comment_end(p + 2, end, newlines);
+      if (close == end)
+        yyerror("Illegal character");
+      mylineno += newlines;
+      p = close + 2;
+    }
+    else {
+      // the character after the $ may be the newline itself
+      const char *newline = kernels.find_newline(p + 1, end);
+      if (newline == end)
+        yyerror("Illegal character");
+      mylineno++;
+      p = newline + 1;
+    }
+  }
+
+  const char *start = p;
+  int token = 0;
+  if (is_letter(*p)) {
+    p = kernels.skip_identifier(p + 1, end);
+    int length = p - start;
+    token = T_id;
+    for (const Keyword &keyword : keywords) {
+      if (keyword.length == length && std::memcmp(keyword.text, start, length) == 0) {
+        token = keyword.token;
+        if (keyword.op)
+          yylval->op = keyword.op;
+        break;
+      }
+    }
+    if (token == T_id)
+      yylval->atom = atoms.intern(start, length);
+  }
+  else if (is_digit(*p)) {
+    for (p++; p < end && is_digit(*p); p++)
+      ;
+    yylval->num = get_int_const(start, p - start);
+    token = T_int_const;
+  }
+  else if (*p == '\'') {
+    int length = escape_length(p + 1);
+    if (length == 0 && is_common_char(p[1]))
+      length = 1;
+    if (length == 0 || p[1 + length] != '\'')
+      yyerror("Illegal character");
+    if (length == 1)
+      yylval->charval = p[1];
+    else if (length == 2)
+      yylval->charval = get_escape_char(p[1], p[2]);
+    else
+      yylval->charval = get_char_from_hex(p[3], p[4]);
+    p += length + 2;
+    token = T_char_const;
+  }
+  else if (*p == '"') {
+    const char *q = kernels.skip_string_chars(p + 1, end);
+    while (*q == '\\') {
+      int length = escape_length(q);
+      if (length == 0)
+        yyerror("Illegal character");
+      q = kernels.skip_string_chars(q + length, end);
+    }
+    if (q == end || *q != '"')
+      yyerror("Illegal character");
+    yylval->stringval = get_string(p + 1, q - p - 1);
+    p = q + 1;
+    token = T_string_literal;
+  }
+  else if ((p[0] == '<' || p[0] == '>') && p[1] == '=') {
+    yylval->op = p[0] == '<' ? 'l' : 'g';
+    token = p[0] == '<' ? T_lessorequal : T_greaterorequal;
+    p += 2;
+  }
+  else if (p[0] == '<' && p[1] == '-') {
+    token = T_assign;
+    p += 2;
+  }
+  else if (*p != '\0' && std::strchr("+-*=#<>()[]{},;:", *p)) {
+    yylval->op = *p;
+    token = *p++;
+  }
+  else {
+    yyerror("Illegal character");
+  }
+  s->cursor = p;
+  return token;
+}
+
+}
+
+int yylex_init(yyscan_t *scanner)
+{
+  *scanner = new Scanner{nullptr, nullptr};
+  return 0;
+}
+
+int yylex_destroy(yyscan_t scanner)
+{
+  delete (Scanner *)scanner;
+  return 0;
+}
+
+// like flex, the scanner reads the buffer in place: its size includes the two NULs
+YY_BUFFER_STATE yy_scan_buffer(char *base, size_t size, yyscan_t scanner)
+{
+  Scanner *s = (Scanner *)scanner;
+  s->cursor = base;
+  s->end = base + size - 2;
+  return (YY_BUFFER_STATE)s;
+}
+
+int yylex(YYSTYPE *yylval_param, yyscan_t yyscanner)
+{
+  return scan((Scanner *)yyscanner, yylval_param);
+}
@@ -0,0 +1,75 @@
+#ifndef __SOURCE_HPP__
+#define __SOURCE_HPP__
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+* A source file mapped into memory, for the scanner to read in place.
+* flex wants its buffer to end in two NUL bytes, so the mapping lies
+* on top of anonymous zero pages that cover them even when the size
+* of the file is a multiple of the page size. The mapping is private
+* and writable because flex terminates each token in place for a
+* moment; only the pages it writes to get copied.
+*/
+class SourceFile {
+public:
+  SourceFile() : base(nullptr), size(0), mapped(0) {}
+  ~SourceFile() { close(); }
+
+  bool open(const std::string &filename)
+  {
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat status;
+    if (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode)) {
+      ::close(fd);
+      return false;
+    }
+    size = status.st_size;
+    size_t page = sysconf(_SC_PAGESIZE);
+    mapped = (size + 2 + page - 1) / page * page;
+    void *zeros = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (zeros == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+    base = (char *)zeros;
+    if (size > 0 && mmap(base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+      ::close(fd);
+      close();
+      return false;
+    }
+    ::close(fd);
+    return true;
+  }
+
+  void close()
+  {
+    if (base)
+      munmap(base, mapped);
+    base = nullptr;
+    size = mapped = 0;
+  }
+
+  const char *text() const { return base; }
+  size_t text_size() const { return size; }
+
+  // the text, followed by the two NUL bytes
+  char *buffer() { return base; }
+  size_t buffer_size() const { return size + 2; }
+
+private:
+  char *base;
+  size_t size;
+  size_t mapped;
+};
+
+#endif
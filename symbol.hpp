@@ -3,33 +3,47 @@
 
 #include <vector>
 #include <string>
-#include <list>
-#include <tuple>
 #include <functional>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include "atom.hpp"
+#include "types.hpp"
 
 extern void yyerror(const char *msg);
 
-enum PassingType { BY_VALUE = 1, BY_REFERENCE };
-enum DataType { TYPE_int = 1, TYPE_char, TYPE_nothing };
 enum EntryKind { FUNCTION = 1, VARIABLE, PARAM};
 
 extern void yyerror2(const char *msg, int line_number);
+[[noreturn]] extern void error_exit();
 
 class STEntry {
 public:
   int offset;
-  std::string name;
+  Atom name;
   int scope_number;
-  int hash_value;
   EntryKind kind;
+  // the entry of the same name in an outer scope, and the previous entry of this scope
+  STEntry *shadowed = nullptr;
+  STEntry *next_in_scope = nullptr;
   bool undefined = false;
   int line_number = 0;
 
   DataType type;
-  std::vector<std::tuple<DataType, PassingType, std::vector<int>, bool>> paramTypes;
-  std::vector<int> dimensions;
-  PassingType passingType;
-  bool missingFirstDimension;
+  const Signature *signature = nullptr;
+  const Shape *shape = types.scalar();
+  PassingType passingType = PassingType::BY_VALUE;
+  bool missingFirstDimension = false;
+
+  // the assignments to a variable, and passings by reference, in its function and the nested ones
+  int assignments = 0;
+  // assigned by a nested function, or passed by reference, where the range analysis of its own function can't see it
+  bool escapes = false;
+  // the value of a variable assigned a constant once, from that assignment on
+  bool constant = false;
+  int value = 0;
+  // the function in the compile-time evaluator, once it is known to be pure
+  int evaluator_index = -1;
 
   std::string TypeName[3] = { "int", "char", "nothing" };
   std::string PassingTypeName[2] = { "by value", "by reference" };
@@ -42,25 +56,24 @@ public:
 class STEntryFunction : public STEntry {
 public:  
   virtual void printEntry() const override {
-    std::cout << "name: " << name << std::endl;
+    std::cout << "name: " << atoms.name(name) << std::endl;
     std::cout << "return type: " << TypeName[type] << std::endl;
-    if(paramTypes.empty()) { std::cout << "no parameters" << std::endl; return; }
+    if(signature->params.empty()) { std::cout << "no parameters" << std::endl; return; }
     std::cout << "param types: ";
-    for (auto x : paramTypes) {
+    for (const Param &x : signature->params) {
       std::cout << std::endl;
-      std::cout << TypeName[std::get<0>(x)] << " " << PassingTypeName[std::get<1>(x)] << " ";
-      if(std::get<3>(x)) std::cout << "[]";
-      if(std::get<2>(x).empty()) continue;
-      for(auto d : std::get<2>(x)) {
+      std::cout << TypeName[x.type] << " " << PassingTypeName[x.passing_type] << " ";
+      if(x.missing_first_dimension) std::cout << "[]";
+      for(auto d : x.shape->dimensions) {
         std::cout << "[" << d << "]";
       }
     }
     std::cout << std::endl;
   }
 
-  STEntryFunction(DataType rt, std::vector<std::tuple<DataType, PassingType, std::vector<int>, bool>> pt) { 
-    type = rt;
-    paramTypes = pt;
+  STEntryFunction(const Signature *s) { 
+    type = s->return_type;
+    signature = s;
     kind = EntryKind::FUNCTION;
   }  
 };
@@ -68,17 +81,17 @@ public:
 class STEntryVariable : public STEntry {
 public:
 
-  STEntryVariable(DataType t, std::vector<int> d) { 
+  STEntryVariable(DataType t, const Shape *s) { 
     type = t;
-    dimensions = d;
+    shape = s;
     kind = EntryKind::VARIABLE;
   }
 
   virtual void printEntry() const override {
-    std::cout << "name: " << name << std::endl;
+    std::cout << "name: " << atoms.name(name) << std::endl;
     std::cout << "type: " << TypeName[type] << " ";
-    if(dimensions.empty()) { std::cout << std::endl; return; }
-    for (auto d : dimensions) {
+    if(shape->is_scalar()) { std::cout << std::endl; return; }
+    for (auto d : shape->dimensions) {
       std::cout << "[" << d << "]";
     }
     std::cout << std::endl;
@@ -92,82 +105,176 @@ public:
 class STEntryParam : public STEntry {
 public:
 
-  STEntryParam(DataType t, PassingType pt, std::vector<int> d, bool m) {
+  STEntryParam(DataType t, PassingType pt, const Shape *s, bool m) {
     type = t;
     passingType = pt;
-    dimensions = d;
+    shape = s;
     missingFirstDimension = m;
     kind = EntryKind::PARAM;
   }
 
   virtual void printEntry() const override {
-    std::cout << "name: " << name << std::endl;
+    std::cout << "name: " << atoms.name(name) << std::endl;
     std::cout << "passing type: " << PassingTypeName[passingType] << std::endl;
     std::cout << "type: " << TypeName[type];
     if(missingFirstDimension) std::cout << "[]";
-    if(dimensions.empty()) { std::cout<< std::endl; return; }
-    for (auto d : dimensions) {
+    if(shape->is_scalar()) { std::cout<< std::endl; return; }
+    for (auto d : shape->dimensions) {
       std::cout << "[" << d << "]";
     }
     std::cout << std::endl;
   }
 };
 
-class HashTable {
+/*
+* Where the entries live: slots as large as the largest kind of entry,
+* in blocks that never move, so an entry stays where it is until its
+* scope closes. The slots of a closed scope go on a free list, for the
+* entries of the next one.
+*/
+class EntryPool {
 public:
-  int hashFunction(std::string str) {
-    std::hash<std::string> hash_fn;
-    return hash_fn(str) % capacity;
+  EntryPool() : free_list(nullptr) {}
+
+  template <class T, class... Args>
+  T *make(Args &&...args) {
+    static_assert(sizeof(T) <= sizeof(Slot) && alignof(T) <= alignof(Slot), "an entry does not fit its slot");
+    if (free_list == nullptr)
+      grow();
+    Slot *slot = free_list;
+    free_list = slot->next;
+    return new (slot) T(std::forward<Args>(args)...);
   }
 
-  HashTable(int c) : capacity(c) {
-    entries = new std::list<STEntry>[capacity];
+  void destroy(STEntry *entry) {
+    entry->~STEntry();
+    Slot *slot = reinterpret_cast<Slot *>(entry);
+    slot->next = free_list;
+    free_list = slot;
   }
 
-  ~HashTable() {
-    // std::cout << "deleting hash table" << std::endl;
-    delete[] entries;
-    
+private:
+  static const size_t block_size = 256;
+
+  union Slot {
+    Slot *next;
+    alignas(STEntry) char bytes[std::max({ sizeof(STEntryFunction), sizeof(STEntryVariable), sizeof(STEntryParam) })];
+  };
+
+  std::vector<std::unique_ptr<Slot[]>> blocks;
+  Slot *free_list;
+
+  void grow() {
+    blocks.emplace_back(new Slot[block_size]);
+    Slot *block = blocks.back().get();
+    for (size_t i = 0; i < block_size; i++) {
+      block[i].next = free_list;
+      free_list = &block[i];
+    }
   }
+};
 
+/*
+* The innermost entry of every name in scope, in open addressing on the
+* atom of the name. The entry points to the one it shadows, which gets
+* its name back when the scope closes. A name keeps its slot once it
+* has one, with no entry while it is out of scope, and the table
+* doubles when it is more than half full.
+*/
+class HashTable {
+public:
+  HashTable(int c) : used(0) {
+    size_t capacity = 16;
+    while (capacity < (size_t)c)
+      capacity *= 2;
+    slots.assign(capacity, Slot{ empty, nullptr });
+  }
+
+  // the innermost entry of the name, nullptr when it is not in scope
+  STEntry *find(Atom name) const {
+    size_t mask = slots.size() - 1;
+    for (size_t i = hashFunction(name) & mask;; i = (i + 1) & mask) {
+      if (slots[i].name == name)
+        return slots[i].entry;
+      if (slots[i].name == empty)
+        return nullptr;
+    }
+  }
+
+  // the entry shadows the one its name had
   void insertItem(STEntry *entry) {
-    int index = hashFunction(entry->name);
-    entry->hash_value = index;
-    // std::cout << "inserting " << entry->name << " at index " << index << std::endl;
-    entries[index].push_front(*entry);
-  }
-
-  void deleteScope(int scope_number) {
-    for (int i = 0; i < capacity; i++) {
-      if(entries[i].empty()) continue;
-      for(std::list<STEntry>::iterator it = entries[i].begin(); it != entries[i].end(); it++) {
-        // std::cout << "deleting " << it->name << " at " << i << std::endl;
-        if (it->scope_number == scope_number) {
-          it = entries[i].erase(it);
-        }
+    STEntry *&innermost = slot_of(entry->name);
+    entry->shadowed = innermost;
+    innermost = entry;
+  }
+
+  // the name gets back the entry the removed one shadowed
+  void removeItem(STEntry *entry) {
+    slot_of(entry->name) = entry->shadowed;
+  }
+
+  void displayHash() const {
+    for (const Slot &slot : slots) {
+      if (slot.entry == nullptr) continue;
+      std::cout << atoms.name(slot.name) << " -->";
+      for (STEntry *e = slot.entry; e != nullptr; e = e->shadowed) {
+        std::cout << " " << e->scope_number;
       }
+      std::cout << std::endl;
     }
   }
 
-  void displayHash() {
-    for (int i = 0; i < capacity; i++) {
-      if(entries[i].empty()) continue;
-       std::cout << i << " --> " ;
-      for (auto x : entries[i]) {
-        std::cout << x.name << " ";
+private:
+  // an enumerator, so that passing it by reference needs no definition
+  enum : Atom { empty = UINT32_MAX };
+
+  struct Slot {
+    Atom name;
+    STEntry *entry;
+  };
+
+  std::vector<Slot> slots;
+  size_t used;
+
+  // atoms are handed out in sequence, an odd multiplier keeps them apart in the low bits
+  static size_t hashFunction(Atom name) {
+    return name * 2654435769u;
+  }
+
+  STEntry *&slot_of(Atom name) {
+    size_t mask = slots.size() - 1;
+    for (size_t i = hashFunction(name) & mask;; i = (i + 1) & mask) {
+      if (slots[i].name == name)
+        return slots[i].entry;
+      if (slots[i].name == empty) {
+        if ((used + 1) * 2 > slots.size()) {
+          grow();
+          return slot_of(name);
+        }
+        used++;
+        slots[i].name = name;
+        return slots[i].entry;
       }
-      std::cout << std::endl;
     }
   }
 
-  // STEntry **table; //pointers to most recent hashed entries
-  std::list<STEntry> *entries;
-  int capacity;
+  void grow() {
+    std::vector<Slot> larger(slots.size() * 2, Slot{ empty, nullptr });
+    size_t mask = larger.size() - 1;
+    for (const Slot &slot : slots) {
+      if (slot.name == empty) continue;
+      size_t i = hashFunction(slot.name) & mask;
+      while (larger[i].name != empty)
+        i = (i + 1) & mask;
+      larger[i] = slot;
+    }
+    slots.swap(larger);
+  }
 };
 
 class Scope {
 public:
-  Scope(int o = -1, int n = 1, DataType rt = DataType::TYPE_nothing) : offset(o), scope_number(n), size(0), return_type(rt) {}
+  Scope(int o = -1, int n = 1, DataType rt = DataType::TYPE_nothing, STEntry *f = nullptr) : function(f), offset(o), scope_number(n), size(0), return_type(rt) {}
 
   int getOffset() const { return offset; }
 
@@ -183,6 +290,14 @@ public:
 
   bool return_exists = false;
 
+  // the entries of the scope, the latest first
+  STEntry *entries = nullptr;
+
+  // the function of the scope, whether it is pure so far, and the names of the functions it calls
+  STEntry *function;
+  bool pure = true;
+  std::vector<std::pair<Atom, int>> callees;
+
   void set_return_exists() {
     return_exists = true;
   }
@@ -200,34 +315,42 @@ private:
 
 class SymbolTable {
 public:
-  SymbolTable(int c = 1001) {
+  SymbolTable(int c = 1024) : capacity(c) {
     hash_table = new HashTable(c);
   }
 
   ~SymbolTable() {
+    clear();
     delete hash_table;
   }
+
+  /*
+  * Forgets every scope and entry, so that
+  * the next program starts with an empty table
+  */
+  void clear() {
+    while (!scopes.empty())
+      closeScope();
+    delete hash_table;
+    hash_table = new HashTable(capacity);
+  }
   void init_library_functions() {
-    std::vector<std::tuple<DataType, PassingType, std::vector<int>, bool>> temp_param_vector;
-    insert_function(std::string("readInteger"), DataType::TYPE_int, temp_param_vector);
-    insert_function(std::string("readChar"), DataType::TYPE_char, temp_param_vector);
-    temp_param_vector.push_back(std::make_tuple(DataType::TYPE_char, PassingType::BY_VALUE, std::vector<int>(), false));
-    insert_function(std::string("writeChar"), DataType::TYPE_nothing, temp_param_vector);
-    insert_function(std::string("ascii"), DataType::TYPE_int, temp_param_vector);
-    temp_param_vector.clear();
-    temp_param_vector.push_back(std::make_tuple(DataType::TYPE_int, PassingType::BY_VALUE, std::vector<int>(), false));
-    insert_function(std::string("writeInteger"), DataType::TYPE_nothing, temp_param_vector);
-    insert_function(std::string("chr"), DataType::TYPE_char, temp_param_vector);
-    temp_param_vector.push_back(std::make_tuple(DataType::TYPE_char, PassingType::BY_REFERENCE, std::vector<int>(), true));
-    insert_function(std::string("readString"), DataType::TYPE_nothing, temp_param_vector);
-    temp_param_vector.clear();
-    temp_param_vector.push_back(std::make_tuple(DataType::TYPE_char, PassingType::BY_REFERENCE, std::vector<int>(), true));
-    insert_function(std::string("writeString"), DataType::TYPE_nothing, temp_param_vector);
-    insert_function(std::string("strlen"), DataType::TYPE_int, temp_param_vector);
-    temp_param_vector.push_back(std::make_tuple(DataType::TYPE_char, PassingType::BY_REFERENCE, std::vector<int>(), true));
-    insert_function(std::string("strcmp"), DataType::TYPE_int, temp_param_vector);
-    insert_function(std::string("strcpy"), DataType::TYPE_nothing, temp_param_vector);
-    insert_function(std::string("strcat"), DataType::TYPE_nothing, temp_param_vector);
+    const Shape *scalar = types.scalar();
+    Param int_value = { DataType::TYPE_int, PassingType::BY_VALUE, scalar, false };
+    Param char_value = { DataType::TYPE_char, PassingType::BY_VALUE, scalar, false };
+    Param string = { DataType::TYPE_char, PassingType::BY_REFERENCE, scalar, true };
+    insert_function(atoms.intern("readInteger"), types.signature(DataType::TYPE_int, {}));
+    insert_function(atoms.intern("readChar"), types.signature(DataType::TYPE_char, {}));
+    insert_function(atoms.intern("writeChar"), types.signature(DataType::TYPE_nothing, { char_value }));
+    insert_function(atoms.intern("ascii"), types.signature(DataType::TYPE_int, { char_value }));
+    insert_function(atoms.intern("writeInteger"), types.signature(DataType::TYPE_nothing, { int_value }));
+    insert_function(atoms.intern("chr"), types.signature(DataType::TYPE_char, { int_value }));
+    insert_function(atoms.intern("readString"), types.signature(DataType::TYPE_nothing, { int_value, string }));
+    insert_function(atoms.intern("writeString"), types.signature(DataType::TYPE_nothing, { string }));
+    insert_function(atoms.intern("strlen"), types.signature(DataType::TYPE_int, { string }));
+    insert_function(atoms.intern("strcmp"), types.signature(DataType::TYPE_int, { string, string }));
+    insert_function(atoms.intern("strcpy"), types.signature(DataType::TYPE_nothing, { string, string }));
+    insert_function(atoms.intern("strcat"), types.signature(DataType::TYPE_nothing, { string, string }));
   }
 
   void display() {
@@ -238,61 +361,53 @@ public:
   * Will return nullptr if there is no entry
   * with the given name in the symbol table
   */
-  STEntry *lookup(std::string str) {
-    int index = hash_table->hashFunction(str);
-    for(auto entry = hash_table->entries[index].begin(); entry != hash_table->entries[index].end(); entry++) {
-      if (entry->name == str) {
-        // std::cout << "found " << str << " of kind " << entry->kind << std::endl;
-        return &(*entry);
-      }
-    }
-    return nullptr;
+  STEntry *lookup(Atom str) {
+    return hash_table->find(str);
   }
 
-  bool was_declared(std::string function_name) {
-    int index = hash_table->hashFunction(function_name);
-    for(auto entry = hash_table->entries[index].begin(); entry != hash_table->entries[index].end(); entry++) {
-      if (entry->name == function_name && entry->kind == EntryKind::FUNCTION) {
+  bool was_declared(Atom function_name) {
+    for (STEntry *entry = hash_table->find(function_name); entry != nullptr; entry = entry->shadowed) {
+      if (entry->kind == EntryKind::FUNCTION) {
         return true;
       }
     }
     return false;
   }
 
-  void insert_function(std::string str, DataType rettype, std::vector<std::tuple<DataType, PassingType, std::vector<int>, bool>> temp_param_vector, int lineno = 0) {
+  void insert_function(Atom str, const Signature *signature, int lineno = 0) {
     STEntry *previous_entry = lookup(str);
     int num = scopes.back().getScopeNumber();
     if (previous_entry != nullptr && previous_entry->scope_number == num) {
       //this might be impossible to reach
       yyerror2("Function name was already declared in this scope", lineno);
     }
-    STEntryFunction *entry = new STEntryFunction(rettype, temp_param_vector);
+    STEntryFunction *entry = pool.make<STEntryFunction>(signature);
     entry->name = str;
     entry->scope_number = num;
     entry->line_number = lineno;
     // std::cout << "scope number: " << entry->scope_number << std::endl;
-    hash_table->insertItem(entry);
+    insert(entry);
     // entry->printEntry();
     scopes.back().incrementSize(1);
   }
 
-  void insert_function_declaration(std::string str, DataType rettype, std::vector<std::tuple<DataType, PassingType, std::vector<int>, bool>> temp_param_vector, int lineno = 0){
+  void insert_function_declaration(Atom str, const Signature *signature, int lineno = 0){
     STEntry *previous_entry = lookup(str);
     int num = scopes.back().getScopeNumber();
     if (previous_entry != nullptr && previous_entry->scope_number == num) {
       yyerror2("Duplicate declaration in the same scope", lineno); 
     }
-    STEntryFunction *entry = new STEntryFunction(rettype, temp_param_vector);
+    STEntryFunction *entry = pool.make<STEntryFunction>(signature);
     entry->name = str;
     entry->undefined = true;
     entry->scope_number = num;
     entry->line_number = lineno;
     // std::cout << "scope number: " << entry->scope_number << std::endl;
-    hash_table->insertItem(entry);
+    insert(entry);
     // entry->printEntry();
   }
 
-  void insert_function_definition(std::string str, DataType rettype, std::vector<std::tuple<DataType, PassingType, std::vector<int>, bool>> temp_param_vector, int lineno = 0){
+  void insert_function_definition(Atom str, const Signature *signature, int lineno = 0){
     //check if declaration is matching
     STEntry *previous_entry = lookup(str);
     int current_scope = scopes.back().getScopeNumber();
@@ -308,73 +423,56 @@ public:
     if(previous_entry->undefined == true && previous_entry->scope_number != current_scope) {
       yyerror2("Function declaration and definition are not in the same scope", lineno);
     }
-    if(previous_entry->type != rettype) {
-      yyerror2("Function return type does not match declaration", lineno);
-    }
-    if(previous_entry->paramTypes.size() != temp_param_vector.size()) {
-      yyerror2("Function parameter number does not match declaration", lineno);
-    }
-    unsigned int e = previous_entry->paramTypes.size();
-    for(unsigned int i = 0; i < e; i++) {
-      if(std::get<0>(previous_entry->paramTypes[i]) != std::get<0>(temp_param_vector[i])) {
-        yyerror2("Function parameter type does not match declaration", lineno);
-      }
-      if(std::get<1>(previous_entry->paramTypes[i]) != std::get<1>(temp_param_vector[i])) {
-        yyerror2("Function parameter passing type does not match declaration", lineno);
-      }
-      if(std::get<2>(previous_entry->paramTypes[i]) != std::get<2>(temp_param_vector[i])) {
-        yyerror2("Function parameter array dimensions do not match declaration", lineno);
-      }
-      if(std::get<3>(previous_entry->paramTypes[i]) != std::get<3>(temp_param_vector[i])) {
-        yyerror2("Function parameter array missing first dimension does not match declaration", lineno);
-      }
+    // the signatures are hash-consed, only a mismatch needs to be looked into
+    if(previous_entry->signature != signature) {
+      report_signature_mismatch(previous_entry->signature, signature, lineno);
     }
     //set undefined to false
     previous_entry->undefined = false;
   }
 
-  void insert_variable(std::string str, DataType type, std::vector<int> dimensions, int lineno) {
+  void insert_variable(Atom str, DataType type, const Shape *shape, int lineno) {
     STEntry *previous_entry = lookup(str);
     int num = scopes.back().getScopeNumber();
     if (previous_entry != nullptr && previous_entry->scope_number == num) { 
       yyerror2("Duplicate declaration", lineno); 
     }
-    for(auto d : dimensions) {
+    for(auto d : shape->dimensions) {
       if(d <= 0) {
         yyerror2("Invalid array size", lineno);
       }
     }
-    STEntryVariable *entry = new STEntryVariable(type, dimensions);
+    STEntryVariable *entry = pool.make<STEntryVariable>(type, shape);
     entry->name = str;
     entry->scope_number = num;
     // std::cout << "scope number: " << entry->scope_number << std::endl;
-    hash_table->insertItem(entry);
+    insert(entry);
     // entry->printEntry();
     scopes.back().incrementSize(1);
   }
 
-  void insert_param(std::string str, DataType type, PassingType passing_type, std::vector<int> dimensions, bool missing_first_dimension, int lineno = 0) {
+  void insert_param(Atom str, DataType type, PassingType passing_type, const Shape *shape, bool missing_first_dimension, int lineno = 0) {
     STEntry *previous_entry = lookup(str);
     int num = scopes.back().getScopeNumber();
     if (previous_entry != nullptr && previous_entry->scope_number == num) { 
       yyerror2("Duplicate parameter declaration", lineno); 
     }
-    STEntryParam *entry = new STEntryParam(type, passing_type, dimensions, missing_first_dimension);
+    STEntryParam *entry = pool.make<STEntryParam>(type, passing_type, shape, missing_first_dimension);
     entry->name = str;
     entry->scope_number = num;
     // std::cout << "scope number: " << entry->scope_number << std::endl;
-    hash_table->insertItem(entry);
+    insert(entry);
     // entry->printEntry();
     scopes.back().incrementSize(1);
   }
 
-  void openScope(DataType return_type = DataType::TYPE_nothing) {
+  void openScope(DataType return_type = DataType::TYPE_nothing, STEntry *function = nullptr) {
     int ofs = 0, number = 1;
     if(!scopes.empty()) {
       ofs = scopes.back().getOffset();
       number = scopes.back().getScopeNumber() + 1;
     }
-    scopes.push_back(Scope(ofs, number, return_type));
+    scopes.push_back(Scope(ofs, number, return_type, function));
     // std::cout << "Opening scope: " << number << std::endl;
   }
 
@@ -388,23 +486,64 @@ public:
     }
   }
 
-  // TODO: implement this
+  // only the entries of the scope are touched, from the latest back
   void closeScope() {
-    int current = scopes.back().getScopeNumber();
-    // std::cout << "closing scope " << current << std::endl;
-    hash_table->deleteScope(current);
+    STEntry *entry = scopes.back().entries;
+    while (entry != nullptr) {
+      STEntry *previous = entry->next_in_scope;
+      hash_table->removeItem(entry);
+      pool.destroy(entry);
+      entry = previous;
+    }
     scopes.pop_back();
   }
 
+  // reports the first of the functions declared in the scope and never defined
   void check_undefined_functions(){
-    for (int i = 0; i < hash_table->capacity; i++) {
-      if(hash_table->entries[i].empty()) continue;
-      for(std::list<STEntry>::iterator it = hash_table->entries[i].begin(); it != hash_table->entries[i].end(); it++) {
-        if(it->kind == EntryKind::FUNCTION && (it->scope_number == scopes.back().getScopeNumber()) && it->undefined == true) {
-          yyerror2("A function is undefined", it->line_number);
-        }
+    STEntry *undefined = nullptr;
+    for (STEntry *entry = scopes.back().entries; entry != nullptr; entry = entry->next_in_scope) {
+      if(entry->kind == EntryKind::FUNCTION && entry->undefined == true) {
+        undefined = entry;
       }
     }
+    if (undefined != nullptr) {
+      yyerror2("A function is undefined", undefined->line_number);
+    }
+  }
+
+  // whether the entry belongs to the function being compiled, and not to one it is nested in
+  bool is_local(const STEntry *entry) {
+    return entry->scope_number == scopes.back().getScopeNumber();
+  }
+
+  /*
+  * A function is pure while it touches no variable of the functions it
+  * is nested in, calls only pure functions, or itself, and does no I/O
+  */
+  void set_impure() {
+    scopes.back().pure = false;
+  }
+
+  void add_call(const STEntry *callee) {
+    Scope &scope = scopes.back();
+    if (callee == scope.function)
+      return;
+    if (callee->evaluator_index < 0)
+      scope.pure = false;
+    else
+      scope.callees.emplace_back(callee->name, callee->evaluator_index);
+  }
+
+  bool is_pure() {
+    return scopes.back().function != nullptr && scopes.back().pure;
+  }
+
+  STEntry *get_function() {
+    return scopes.back().function;
+  }
+
+  const std::vector<std::pair<Atom, int>> &get_callees() {
+    return scopes.back().callees;
   }
 
   int not_exists_scope() {
@@ -418,8 +557,40 @@ public:
 private:
   std::vector<Scope> scopes;
   HashTable *hash_table;
+  EntryPool pool;
+  int capacity;
+
+  void report_signature_mismatch(const Signature *declared, const Signature *defined, int lineno) {
+    if(declared->return_type != defined->return_type) {
+      yyerror2("Function return type does not match declaration", lineno);
+    }
+    if(declared->params.size() != defined->params.size()) {
+      yyerror2("Function parameter number does not match declaration", lineno);
+    }
+    for(unsigned int i = 0; i < declared->params.size(); i++) {
+      const Param &d = declared->params[i], &p = defined->params[i];
+      if(d.type != p.type) {
+        yyerror2("Function parameter type does not match declaration", lineno);
+      }
+      if(d.passing_type != p.passing_type) {
+        yyerror2("Function parameter passing type does not match declaration", lineno);
+      }
+      if(d.shape != p.shape) {
+        yyerror2("Function parameter array dimensions do not match declaration", lineno);
+      }
+      if(d.missing_first_dimension != p.missing_first_dimension) {
+        yyerror2("Function parameter array missing first dimension does not match declaration", lineno);
+      }
+    }
+  }
+
+  void insert(STEntry *entry) {
+    hash_table->insertItem(entry);
+    entry->next_in_scope = scopes.back().entries;
+    scopes.back().entries = entry;
+  }
 };
 
-extern SymbolTable st;
+extern thread_local SymbolTable st;
 
 #endif
@@ -0,0 +1,351 @@
+#ifndef __TIER_HPP__
+#define __TIER_HPP__
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "vm.hpp"
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/TargetSelect.h"
+
+// Define global flags
+extern bool tiered_execution;
+extern unsigned tier_threshold;
+
+/*
+* The second tier of the tiered mode. Functions that the VM finds hot
+* are translated from their bytecode to llvm code, optimized and
+* compiled on a background thread, and handed back to the VM as native
+* code for their later calls. The native code keeps the frames of the
+* VM, so it can call and be called by the functions still interpreted.
+*/
+class TieredCompiler {
+public:
+  TieredCompiler(VM &v) : vm(v), program(v.get_program())
+  {
+    static std::once_flag target_initialized;
+    std::call_once(target_initialized, []() {
+      llvm::InitializeNativeTarget();
+      llvm::InitializeNativeTargetAsmPrinter();
+    });
+    auto J = llvm::orc::LLJITBuilder().create();
+    if (!J) {
+      // without a jit everything stays interpreted
+      llvm::consumeError(J.takeError());
+      return;
+    }
+    jit = std::move(*J);
+
+    llvm::orc::MangleAndInterner Mangle(jit->getExecutionSession(), jit->getDataLayout());
+    llvm::orc::SymbolMap entry_points;
+    entry_points[Mangle("gracevm_call")] = symbol((void *)&VM::native_call);
+    entry_points[Mangle("gracevm_library")] = symbol((void *)&VM::native_library);
+    entry_points[Mangle("gracevm_fault")] = symbol((void *)&VM::native_fault);
+    if (llvm::Error error = jit->getMainJITDylib().define(llvm::orc::absoluteSymbols(entry_points))) {
+      llvm::consumeError(std::move(error));
+      jit.reset();
+      return;
+    }
+
+    vm.set_hot_callback(tier_threshold, [this](int index) { request(index); });
+    worker = std::thread([this]() { compile_requests(); });
+  }
+
+  // waits for the function being compiled, drops the rest
+  ~TieredCompiler()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeup.notify_one();
+    if (worker.joinable())
+      worker.join();
+  }
+
+private:
+  VM &vm;
+  const VMProgram &program;
+  std::unique_ptr<llvm::orc::LLJIT> jit;
+  std::thread worker;
+
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  std::deque<int> queue;
+  std::set<int> requested;
+  bool stopping = false;
+
+  static llvm::JITEvaluatedSymbol symbol(void *address)
+  {
+    return llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(address), llvm::JITSymbolFlags::Exported);
+  }
+
+  void request(int index)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!requested.insert(index).second)
+        return;
+      queue.push_back(index);
+    }
+    wakeup.notify_one();
+  }
+
+  void compile_requests()
+  {
+    for (;;) {
+      int index;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wakeup.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (stopping)
+          return;
+        index = queue.front();
+        queue.pop_front();
+      }
+      compile(index);
+    }
+  }
+
+  void compile(int index)
+  {
+    auto context = std::make_unique<llvm::LLVMContext>();
+    std::string name = "tier_" + std::to_string(index);
+    auto module = std::make_unique<llvm::Module>(name, *context);
+    module->setDataLayout(jit->getDataLayout());
+    module->setTargetTriple(jit->getTargetTriple().str());
+    llvm::Function *F = translate(index, name, *module);
+    if (llvm::verifyFunction(*F, &llvm::errs()))
+      return;
+
+    llvm::PassManagerBuilder PMB;
+    PMB.OptLevel = 2;
+    llvm::legacy::FunctionPassManager FPM(module.get());
+    llvm::legacy::PassManager MPM;
+    PMB.populateFunctionPassManager(FPM);
+    PMB.populateModulePassManager(MPM);
+    FPM.doInitialization();
+    FPM.run(*F);
+    FPM.doFinalization();
+    MPM.run(*module);
+
+    if (llvm::Error error = jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)))) {
+      llvm::consumeError(std::move(error));
+      return;
+    }
+    auto native = jit->lookup(name);
+    if (!native) {
+      llvm::consumeError(native.takeError());
+      return;
+    }
+    vm.set_native(index, (NativeFunction)native->getAddress());
+  }
+
+  /*
+  * Every register becomes an alloca that mem2reg turns into a value,
+  * every jump target starts a basic block, and frame and memory
+  * accesses index the memory of the VM like the interpreter does
+  */
+  llvm::Function *translate(int index, const std::string &name, llvm::Module &M)
+  {
+    llvm::LLVMContext &C = M.getContext();
+    llvm::IRBuilder<> Builder(C);
+    llvm::Type *i8 = llvm::Type::getInt8Ty(C), *i32 = llvm::Type::getInt32Ty(C);
+    llvm::Type *i8ptr = i8->getPointerTo(), *i32ptr = i32->getPointerTo();
+
+    llvm::Function *F = llvm::Function::Create(llvm::FunctionType::get(i32, { i8ptr, i8ptr, i32 }, false),
+                                               llvm::Function::ExternalLinkage, name, M);
+    llvm::FunctionCallee call = M.getOrInsertFunction("gracevm_call",
+      llvm::FunctionType::get(i32, { i8ptr, i32, i32, i32, i32ptr }, false));
+    llvm::FunctionCallee library = M.getOrInsertFunction("gracevm_library",
+      llvm::FunctionType::get(i32, { i8ptr, i32, i32ptr }, false));
+    llvm::FunctionCallee fault = M.getOrInsertFunction("gracevm_fault",
+      llvm::FunctionType::get(llvm::Type::getVoidTy(C), { i32 }, false));
+    llvm::cast<llvm::Function>(fault.getCallee())->setDoesNotReturn();
+
+    llvm::Value *vm_arg = F->getArg(0), *memory = F->getArg(1), *fp = F->getArg(2);
+    auto c32 = [&](int32_t n) { return llvm::ConstantInt::get(i32, n, true); };
+
+    const VMFunction &function = program.functions[index];
+    const std::vector<Instruction> &code = function.code;
+    Builder.SetInsertPoint(llvm::BasicBlock::Create(C, "entry", F));
+    std::vector<llvm::Value *> registers;
+    for (int r = 0; r < function.registers; r++)
+      registers.push_back(Builder.CreateAlloca(i32));
+    size_t most_args = 2;
+    for (const Instruction &I : code)
+      if (I.op == Op::CALL)
+        most_args = std::max(most_args, program.functions[I.b].params.size());
+    llvm::Value *args = Builder.CreateAlloca(i32, c32(most_args));
+    llvm::BasicBlock *entry = Builder.GetInsertBlock();
+
+    // faults are shared by the whole function
+    llvm::BasicBlock *memory_fault = llvm::BasicBlock::Create(C, "memoryfault", F);
+    Builder.SetInsertPoint(memory_fault);
+    Builder.CreateCall(fault, { c32(0) });
+    Builder.CreateUnreachable();
+    llvm::BasicBlock *division_fault = llvm::BasicBlock::Create(C, "divisionfault", F);
+    Builder.SetInsertPoint(division_fault);
+    Builder.CreateCall(fault, { c32(1) });
+    Builder.CreateUnreachable();
+
+    std::map<int, llvm::BasicBlock *> blocks;
+    auto block = [&](int pc) {
+      llvm::BasicBlock *&BB = blocks[pc];
+      if (!BB) BB = llvm::BasicBlock::Create(C, "pc" + std::to_string(pc), F);
+      return BB;
+    };
+    for (unsigned pc = 0; pc < code.size(); pc++) {
+      const Instruction &I = code[pc];
+      switch (I.op) {
+      case Op::JMP: block(I.a); break;
+      case Op::JZ: case Op::JNZ: block(I.b); break;
+      case Op::JEQ: case Op::JNE: case Op::JLT: case Op::JGT: case Op::JLE: case Op::JGE: block(I.c); break;
+      default: continue;
+      }
+      if (pc + 1 < code.size()) block(pc + 1);
+    }
+    Builder.SetInsertPoint(entry);
+    Builder.CreateBr(block(0));
+
+    auto get = [&](int r) { return Builder.CreateLoad(i32, registers[r]); };
+    auto set = [&](int r, llvm::Value *v) { Builder.CreateStore(v, registers[r]); };
+    auto pointer = [&](llvm::Value *address, llvm::Type *type) {
+      llvm::Value *p = Builder.CreateGEP(i8, memory, Builder.CreateSExt(address, Builder.getInt64Ty()));
+      return Builder.CreateBitCast(p, type->getPointerTo());
+    };
+    auto load = [&](llvm::Value *address, llvm::Type *type) {
+      llvm::Value *v = Builder.CreateAlignedLoad(type, pointer(address, type), llvm::MaybeAlign(1));
+      return type == i8 ? Builder.CreateSExt(v, i32) : v;
+    };
+    auto store = [&](llvm::Value *address, llvm::Value *v, llvm::Type *type) {
+      if (type == i8) v = Builder.CreateTrunc(v, i8);
+      Builder.CreateAlignedStore(v, pointer(address, type), llvm::MaybeAlign(1));
+    };
+    auto check = [&](llvm::Value *address, int32_t size) {
+      llvm::BasicBlock *ok = llvm::BasicBlock::Create(C, "inbounds", F);
+      Builder.CreateCondBr(Builder.CreateICmpUGT(address, c32(VM::memory_size - size)), memory_fault, ok);
+      Builder.SetInsertPoint(ok);
+    };
+    auto cmp = [&](Op op, llvm::Value *l, llvm::Value *r) {
+      switch (op) {
+      case Op::EQ: case Op::JEQ: return Builder.CreateICmpEQ(l, r);
+      case Op::NE: case Op::JNE: return Builder.CreateICmpNE(l, r);
+      case Op::LT: case Op::JLT: return Builder.CreateICmpSLT(l, r);
+      case Op::GT: case Op::JGT: return Builder.CreateICmpSGT(l, r);
+      case Op::LE: case Op::JLE: return Builder.CreateICmpSLE(l, r);
+      default: return Builder.CreateICmpSGE(l, r);
+      }
+    };
+    auto pass = [&](int first, int count) {
+      for (int i = 0; i < count; i++)
+        Builder.CreateStore(get(first + i), Builder.CreateGEP(i32, args, c32(i)));
+    };
+
+    for (unsigned pc = 0; pc < code.size(); pc++) {
+      auto it = blocks.find(pc);
+      if (it != blocks.end()) {
+        if (pc != 0 && !Builder.GetInsertBlock()->getTerminator())
+          Builder.CreateBr(it->second);
+        Builder.SetInsertPoint(it->second);
+      } else if (Builder.GetInsertBlock()->getTerminator()) {
+        continue; // unreachable
+      }
+      const Instruction &I = code[pc];
+      switch (I.op) {
+      case Op::CONST: set(I.a, c32(I.b)); break;
+      case Op::MOV: set(I.a, get(I.b)); break;
+      case Op::ADD: set(I.a, Builder.CreateAdd(get(I.b), get(I.c))); break;
+      case Op::SUB: set(I.a, Builder.CreateSub(get(I.b), get(I.c))); break;
+      case Op::MUL: set(I.a, Builder.CreateMul(get(I.b), get(I.c))); break;
+      case Op::DIV:
+      case Op::MOD: {
+        llvm::Value *l = get(I.b), *r = get(I.c);
+        llvm::BasicBlock *ok = llvm::BasicBlock::Create(C, "nonzero", F);
+        Builder.CreateCondBr(Builder.CreateICmpEQ(r, c32(0)), division_fault, ok);
+        Builder.SetInsertPoint(ok);
+        // INT_MIN / -1 overflows, as in the interpreter
+        llvm::Value *minus_one = Builder.CreateICmpEQ(r, c32(-1));
+        llvm::Value *divisor = Builder.CreateSelect(minus_one, c32(1), r);
+        if (I.op == Op::DIV)
+          set(I.a, Builder.CreateSelect(minus_one, Builder.CreateNeg(l), Builder.CreateSDiv(l, divisor)));
+        else
+          set(I.a, Builder.CreateSelect(minus_one, c32(0), Builder.CreateSRem(l, divisor)));
+        break;
+      }
+      case Op::ADDI: set(I.a, Builder.CreateAdd(get(I.b), c32(I.c))); break;
+      case Op::MULI: set(I.a, Builder.CreateMul(get(I.b), c32(I.c))); break;
+      case Op::NEG: set(I.a, Builder.CreateNeg(get(I.b))); break;
+      case Op::SEXT8: set(I.a, Builder.CreateSExt(Builder.CreateTrunc(get(I.b), i8), i32)); break;
+      case Op::EQ: case Op::NE: case Op::LT: case Op::GT: case Op::LE: case Op::GE:
+        set(I.a, Builder.CreateZExt(cmp(I.op, get(I.b), get(I.c)), i32));
+        break;
+      case Op::NOT: set(I.a, Builder.CreateZExt(Builder.CreateICmpEQ(get(I.b), c32(0)), i32)); break;
+      case Op::JMP: Builder.CreateBr(block(I.a)); break;
+      case Op::JZ:
+      case Op::JNZ: {
+        llvm::Value *zero = Builder.CreateICmpEQ(get(I.a), c32(0));
+        if (I.op == Op::JZ) Builder.CreateCondBr(zero, block(I.b), block(pc + 1));
+        else Builder.CreateCondBr(zero, block(pc + 1), block(I.b));
+        break;
+      }
+      case Op::JEQ: case Op::JNE: case Op::JLT: case Op::JGT: case Op::JLE: case Op::JGE:
+        Builder.CreateCondBr(cmp(I.op, get(I.a), get(I.b)), block(I.c), block(pc + 1));
+        break;
+      case Op::LOOP: break;
+      case Op::FRAME: set(I.a, Builder.CreateAdd(fp, c32(I.b))); break;
+      case Op::ADDRUP: {
+        llvm::Value *frame = fp;
+        for (int hops = I.b; hops > 0; hops--)
+          frame = load(frame, i32);
+        set(I.a, Builder.CreateAdd(frame, c32(I.c)));
+        break;
+      }
+      case Op::LOADL32: set(I.a, load(Builder.CreateAdd(fp, c32(I.b)), i32)); break;
+      case Op::LOADL8: set(I.a, load(Builder.CreateAdd(fp, c32(I.b)), i8)); break;
+      case Op::STOREL32: store(Builder.CreateAdd(fp, c32(I.a)), get(I.b), i32); break;
+      case Op::STOREL8: store(Builder.CreateAdd(fp, c32(I.a)), get(I.b), i8); break;
+      case Op::LOAD32:
+      case Op::LOAD8: {
+        llvm::Value *address = get(I.b);
+        check(address, I.op == Op::LOAD32 ? 4 : 1);
+        set(I.a, load(address, I.op == Op::LOAD32 ? i32 : i8));
+        break;
+      }
+      case Op::STORE32:
+      case Op::STORE8: {
+        llvm::Value *address = get(I.a);
+        check(address, I.op == Op::STORE32 ? 4 : 1);
+        store(address, get(I.b), I.op == Op::STORE32 ? i32 : i8);
+        break;
+      }
+      case Op::CALL:
+        pass(I.c, program.functions[I.b].params.size());
+        set(I.a, Builder.CreateCall(call, { vm_arg, c32(index), fp, c32(I.b), args }));
+        break;
+      case Op::LIB:
+        pass(I.c, VM::library_arity((LibraryFunction)I.b));
+        set(I.a, Builder.CreateCall(library, { vm_arg, c32(I.b), args }));
+        break;
+      case Op::RET: Builder.CreateRet(get(I.a)); break;
+      case Op::RETV: Builder.CreateRet(c32(0)); break;
+      }
+    }
+    return F;
+  }
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef __TIMER_HPP__
+#define __TIMER_HPP__
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Define global flags
+extern bool time_report;
+
+/*
+* Wall time spent in each phase of a compilation, for -ftime-report.
+* A PhaseTimer charges the time of its scope to its phase, except for
+* the time of the timers nested in it, so the phases add up to the
+* total. The times are kept per thread, like the rest of the state
+* of a compilation.
+*/
+class PhaseTimer {
+public:
+  PhaseTimer(const char *p) : phase(p), parent(current())
+  {
+    if (!time_report) return;
+    start = std::chrono::steady_clock::now();
+    if (parent)
+      parent->charge(start);
+    current() = this;
+  }
+
+  ~PhaseTimer()
+  {
+    if (!time_report) return;
+    auto now = std::chrono::steady_clock::now();
+    charge(now);
+    if (parent)
+      parent->start = now;
+    current() = parent;
+  }
+
+  // prints the phases of the last compilation and starts over
+  static void report(const std::string &filename)
+  {
+    std::string out = "Phase times of " + filename + " (ms):\n";
+    double total = 0;
+    char line[64];
+    for (const auto &phase : times()) {
+      std::snprintf(line, sizeof(line), "  %-10s %10.3f\n", phase.first.c_str(), phase.second);
+      out += line;
+      total += phase.second;
+    }
+    std::snprintf(line, sizeof(line), "  %-10s %10.3f\n", "total", total);
+    out += line;
+    std::cerr << out;
+    times().clear();
+  }
+
+private:
+  const char *phase;
+  PhaseTimer *parent;
+  std::chrono::steady_clock::time_point start;
+
+  void charge(std::chrono::steady_clock::time_point now)
+  {
+    double ms = std::chrono::duration<double, std::milli>(now - start).count();
+    for (auto &entry : times()) {
+      if (entry.first == phase) {
+        entry.second += ms;
+        return;
+      }
+    }
+    times().emplace_back(phase, ms);
+  }
+
+  static PhaseTimer *&current()
+  {
+    static thread_local PhaseTimer *timer = nullptr;
+    return timer;
+  }
+
+  // in the order the phases first ran
+  static std::vector<std::pair<std::string, double>> &times()
+  {
+    static thread_local std::vector<std::pair<std::string, double>> phases;
+    return phases;
+  }
+};
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef __TYPES_HPP__
+#define __TYPES_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_set>
+#include <vector>
+
+enum PassingType { BY_VALUE = 1, BY_REFERENCE };
+enum DataType { TYPE_int = 1, TYPE_char, TYPE_nothing };
+
+/*
+* The shape of an array: its dimensions, none for a scalar, and 0 first
+* when the first one is unknown (an array parameter declared with []).
+* Shapes are hash-consed, so two shapes are equal when their pointers
+* are, and each one finds the shapes derived from it only once.
+*/
+struct Shape {
+  std::vector<int> dimensions;
+  // the shape of its elements, and the shape with an unknown first dimension in front
+  mutable const Shape *element = nullptr;
+  mutable const Shape *unknown_first = nullptr;
+
+  bool is_scalar() const { return dimensions.empty(); }
+
+  bool operator==(const Shape &other) const { return dimensions == other.dimensions; }
+};
+
+struct Param {
+  DataType type;
+  PassingType passing_type;
+  const Shape *shape;
+  bool missing_first_dimension;
+
+  bool operator==(const Param &other) const
+  {
+    return type == other.type && passing_type == other.passing_type && shape == other.shape && missing_first_dimension == other.missing_first_dimension;
+  }
+};
+
+// A signature is hash-consed too, so a definition matches its declaration when their pointers are equal
+struct Signature {
+  DataType return_type;
+  std::vector<Param> params;
+
+  bool operator==(const Signature &other) const
+  {
+    return return_type == other.return_type && params == other.params;
+  }
+};
+
+/*
+* The table of the shapes and the signatures, which builds each distinct
+* one once. Its elements never move, and it lives as long as the
+* thread, like the atoms: a program has only a few distinct types.
+*/
+class TypeTable {
+public:
+  TypeTable() : scalar_shape(shape(std::vector<int>())) {}
+
+  const Shape *scalar() const { return scalar_shape; }
+
+  const Shape *shape(const std::vector<int> &dimensions)
+  {
+    Shape key;
+    key.dimensions = dimensions;
+    return &*shapes.insert(std::move(key)).first;
+  }
+
+  // the shape of the elements of an array of the shape
+  const Shape *element(const Shape *s)
+  {
+    if (s->element == nullptr)
+      s->element = shape(std::vector<int>(s->dimensions.begin() + 1, s->dimensions.end()));
+    return s->element;
+  }
+
+  const Shape *unknown_first(const Shape *s)
+  {
+    if (s->unknown_first == nullptr) {
+      std::vector<int> dimensions(1, 0);
+      dimensions.insert(dimensions.end(), s->dimensions.begin(), s->dimensions.end());
+      s->unknown_first = shape(dimensions);
+    }
+    return s->unknown_first;
+  }
+
+  const Signature *signature(DataType return_type, const std::vector<Param> &params)
+  {
+    return &*signatures.insert(Signature{ return_type, params }).first;
+  }
+
+private:
+  struct ShapeHash {
+    size_t operator()(const Shape &s) const
+    {
+      size_t hash = s.dimensions.size();
+      for (int d : s.dimensions)
+        hash = hash * 31 + d;
+      return hash;
+    }
+  };
+
+  // the shapes of the parameters are hashed by their address, which stands for them
+  struct SignatureHash {
+    size_t operator()(const Signature &s) const
+    {
+      size_t hash = s.return_type;
+      for (const Param &p : s.params) {
+        hash = hash * 31 + std::hash<const Shape *>()(p.shape);
+        hash = hash * 31 + (p.type << 3 | p.passing_type << 1 | p.missing_first_dimension);
+      }
+      return hash;
+    }
+  };
+
+  // the nodes of an unordered_set stay where they are when it rehashes
+  std::unordered_set<Shape, ShapeHash> shapes;
+  std::unordered_set<Signature, SignatureHash> signatures;
+  const Shape *scalar_shape;
+};
+
+// Every thread has its own table, like its own atoms
+extern thread_local TypeTable types;
+
+#endif
@@ -0,0 +1,697 @@
+#ifndef __VM_HPP__
+#define __VM_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <csetjmp>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "runtime.hpp"
+#include "atom.hpp"
+
+/*
+* A register-based bytecode for checked Grace programs, and the
+* interpreter that runs it without going through LLVM at all.
+*
+* Variables live in frames in a flat byte memory, so that addresses
+* work the same for locals, by-reference parameters, multi-dimensional
+* arrays and string literals. Every frame starts with the static link,
+* the address of the frame of the enclosing function. Temporaries live
+* in a window of registers that every call gets for itself.
+*/
+enum class Op : uint8_t {
+  CONST,    // a = imm b
+  MOV,      // a = b
+  ADD, SUB, MUL, DIV, MOD,  // a = b op c
+  ADDI,     // a = b + imm c
+  MULI,     // a = b * imm c
+  NEG,      // a = -b
+  SEXT8,    // a = b truncated to a char
+  EQ, NE, LT, GT, LE, GE,   // a = b cmp c
+  NOT,      // a = !b
+  JMP,      // goto a
+  JZ, JNZ,  // if (a == 0) / if (a != 0) goto b
+  JEQ, JNE, JLT, JGT, JLE, JGE,  // if (a cmp b) goto c
+  LOOP,     // a loop back-edge, counted in the tiered mode
+  FRAME,    // a = address of the local at offset b
+  ADDRUP,   // a = address of the variable at offset c of the frame b links up
+  LOADL32, LOADL8,    // a = local at offset b
+  STOREL32, STOREL8,  // local at offset a = b
+  LOAD32, LOAD8,      // a = memory[b]
+  STORE32, STORE8,    // memory[a] = b
+  CALL,     // a = function b(registers c...)
+  LIB,      // a = library function b(registers c...)
+  RET,      // return a
+  RETV      // return
+};
+
+struct Instruction {
+  Op op;
+  int32_t a, b, c;
+};
+
+enum class LibraryFunction {
+  writeInteger, writeChar, writeString, readInteger, readChar, readString,
+  ascii, chr, strlen, strcmp, strcpy, strcat
+};
+
+struct VMParam {
+  int32_t offset;
+  int32_t size;
+};
+
+struct VMFunction {
+  std::string name;
+  int depth = 0;
+  int frame_size = 4;
+  int registers = 0;
+  std::vector<VMParam> params;
+  std::vector<bool> by_reference;
+  std::vector<Instruction> code;
+};
+
+struct VMProgram {
+  std::vector<VMFunction> functions;
+  std::string constants;
+};
+
+/*
+* Lowers the checked AST into a VMProgram. The AST nodes drive it
+* through their lower_* methods, much like they drive the IRBuilder
+* in codegen; this keeps track of the scopes, the frame layout,
+* the registers and the jump targets of the functions being lowered.
+*/
+class BytecodeBuilder {
+public:
+  struct Variable {
+    int32_t offset;
+    int32_t size;     // of the value, or of the elements of an array
+    bool reference;   // the frame holds its address
+    int hops;         // how many static links away its frame is
+  };
+
+  BytecodeBuilder() : scopes(1) { program.constants.assign(4, '\0'); }
+
+  VMProgram program;
+  bool count_loops = false; // for the tiered mode
+
+  /*
+  * Functions are declared in the scope of the function that contains
+  * them. A declaration and the definition that follows share an index.
+  */
+  int declare_function(Atom name, const std::vector<bool> &by_reference,
+                       const std::vector<int32_t> &sizes)
+  {
+    auto it = scopes.back().functions.find(name);
+    if (it != scopes.back().functions.end())
+      return it->second;
+    return scopes.back().functions[name] = add_function(name, by_reference, sizes);
+  }
+
+  // adds a function that no scope knows of, for bind_function to name
+  int add_function(Atom name, const std::vector<bool> &by_reference,
+                   const std::vector<int32_t> &sizes)
+  {
+    VMFunction F;
+    F.name = atoms.name(name);
+    F.depth = scopes.size() - 1;
+    F.by_reference = by_reference;
+    for (unsigned i = 0; i < sizes.size(); i++) {
+      F.params.push_back({ F.frame_size, by_reference[i] ? 4 : sizes[i] });
+      F.frame_size += 4;
+    }
+    program.functions.push_back(F);
+    return program.functions.size() - 1;
+  }
+
+  // the calls of the name in the function being lowered go to the function
+  void bind_function(Atom name, int index)
+  {
+    scopes.back().functions[name] = index;
+  }
+
+  int lookup_function(Atom name) const
+  {
+    for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+      auto it = scope->functions.find(name);
+      if (it != scope->functions.end())
+        return it->second;
+    }
+    return -1;
+  }
+
+  const VMFunction &get_function(int index) const { return program.functions[index]; }
+
+  void begin_function(int index)
+  {
+    scopes.emplace_back();
+    functions.push_back({ index });
+  }
+
+  void declare_parameter(Atom name, unsigned i, int32_t size)
+  {
+    const VMFunction &F = program.functions[functions.back().index];
+    scopes.back().variables[name] = { F.params[i].offset, size, F.by_reference[i], 0 };
+  }
+
+  void declare_variable(Atom name, int32_t size, int32_t count)
+  {
+    VMFunction &F = program.functions[functions.back().index];
+    scopes.back().variables[name] = { F.frame_size, size, false, 0 };
+    F.frame_size += (size * count + 3) & ~3;
+  }
+
+  Variable lookup_variable(Atom name) const
+  {
+    for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+      auto it = scope->variables.find(name);
+      if (it != scope->variables.end()) {
+        Variable v = it->second;
+        v.hops = scope - scopes.rbegin();
+        return v;
+      }
+    }
+    std::cerr << "Unknown variable name " << atoms.name(name) << std::endl;
+    exit(1);
+  }
+
+  /*
+  * Closes the function with the default return, the one
+  * the llvm code gets when the end of the body is reachable
+  */
+  void end_function(bool returns_value)
+  {
+    if (returns_value) {
+      int r = reg();
+      emit(Op::CONST, r, 0);
+      emit(Op::RET, r);
+    } else {
+      emit(Op::RETV);
+    }
+    FunctionState &S = functions.back();
+    VMFunction &F = program.functions[S.index];
+    for (const auto &fixup : S.fixups) {
+      Instruction &I = F.code[fixup.first];
+      int target = S.labels[fixup.second];
+      if (I.op == Op::JMP) I.a = target;
+      else if (I.op == Op::JZ || I.op == Op::JNZ) I.b = target;
+      else I.c = target;
+    }
+    F.registers = S.max_registers;
+    functions.pop_back();
+    scopes.pop_back();
+  }
+
+  /*
+  * Registers are handed out like a stack: a statement
+  * releases everything its expressions allocated
+  */
+  int reg()
+  {
+    FunctionState &S = functions.back();
+    if (S.next_register + 1 > S.max_registers)
+      S.max_registers = S.next_register + 1;
+    return S.next_register++;
+  }
+  int mark() const { return functions.back().next_register; }
+  void release(int mark) { functions.back().next_register = mark; }
+
+  int new_label()
+  {
+    functions.back().labels.push_back(-1);
+    return functions.back().labels.size() - 1;
+  }
+  void bind(int label)
+  {
+    FunctionState &S = functions.back();
+    S.labels[label] = program.functions[S.index].code.size();
+  }
+
+  void emit(Op op, int32_t a = 0, int32_t b = 0, int32_t c = 0)
+  {
+    program.functions[functions.back().index].code.push_back({ op, a, b, c });
+  }
+  // the target goes in the operand after the registers the jump compares
+  void emit_jump(Op op, int label, int32_t a = 0, int32_t b = 0)
+  {
+    FunctionState &S = functions.back();
+    S.fixups.push_back({ (int)program.functions[S.index].code.size(), label });
+    emit(op, a, b);
+  }
+
+  int32_t string_constant(const std::string &s)
+  {
+    int32_t address = program.constants.size();
+    program.constants += s;
+    program.constants += '\0';
+    return address;
+  }
+
+  // the library atoms come in the order of LibraryFunction
+  static bool get_library_function(Atom name, LibraryFunction &f)
+  {
+    if (!AtomTable::is_library(name))
+      return false;
+    f = LibraryFunction(name - AtomTable::first_library_atom);
+    return true;
+  }
+
+private:
+  struct Scope {
+    std::unordered_map<Atom, Variable> variables;
+    std::unordered_map<Atom, int> functions;
+  };
+  struct FunctionState {
+    int index;
+    int next_register = 0;
+    int max_registers = 0;
+    std::vector<int> labels;
+    std::vector<std::pair<int, int>> fixups;
+  };
+
+  std::vector<Scope> scopes;
+  std::vector<FunctionState> functions;
+};
+
+class VM;
+
+// Native code for a function, called with the frame already set up
+typedef int32_t (*NativeFunction)(VM *vm, char *memory, int32_t fp);
+
+/*
+* Runs a VMProgram in a fixed amount of memory: the string
+* constants at the bottom, then a stack of frames.
+*
+* In the tiered mode functions get replaced by native code while
+* the program runs (see tier.hpp). Native code works on the same
+* frames, so it calls and gets called by interpreted code directly.
+*/
+class VM {
+public:
+  static const int32_t memory_size = 16 * 1024 * 1024;
+  static const int32_t register_count = 1024 * 1024;
+
+  VM(const VMProgram &p)
+    : program(p), memory((char *)std::calloc(memory_size, 1), &std::free),
+      registers((int32_t *)std::calloc(register_count, sizeof(int32_t)), &std::free),
+      heat(p.functions.size()), native(new std::atomic<NativeFunction>[p.functions.size()])
+  {
+    if (!memory || !registers)
+      error("Out of memory");
+    std::memcpy(memory.get(), program.constants.data(), program.constants.size());
+    register_top = registers.get();
+    sp = (program.constants.size() + 3) & ~3;
+    for (unsigned i = 0; i < program.functions.size(); i++)
+      native[i] = nullptr;
+  }
+
+  /*
+  * Calls and loop back-edges count towards how hot a function is.
+  * The callback hears about every function that reaches the threshold.
+  */
+  void set_hot_callback(uint32_t threshold, std::function<void(int)> callback)
+  {
+    hot_threshold = threshold;
+    on_hot = callback;
+  }
+
+  // later calls of the function run the native code
+  void set_native(int index, NativeFunction f)
+  {
+    native[index].store(f, std::memory_order_release);
+  }
+
+  const VMProgram &get_program() const { return program; }
+
+  // the frames of a call stop here, below the memory it has
+  void set_stack_limit(int32_t limit) { stack_limit = limit; }
+
+  /*
+  * Calls a function on its own, for the compiler to evaluate a call with
+  * constant arguments. Every call starts from clean memory, and the
+  * hot callback is the budget of each function: the count of its calls
+  * and loop iterations starts over. A runtime error, or a callback that
+  * calls fail(), ends the call and returns false.
+  */
+  bool call(int index, const int32_t *args, int32_t &result)
+  {
+    std::memcpy(memory.get(), program.constants.data(), program.constants.size());
+    sp = (program.constants.size() + 3) & ~3;
+    register_top = registers.get();
+    frames.clear();
+    std::fill(heat.begin(), heat.end(), 0);
+    std::jmp_buf failed;
+    std::jmp_buf *outer = on_error();
+    if (setjmp(failed)) {
+      on_error() = outer;
+      return false;
+    }
+    on_error() = &failed;
+    const VMFunction *F = &program.functions[index];
+    int32_t fp = enter(F, 0, args);
+    result = execute(index, fp);
+    on_error() = outer;
+    return true;
+  }
+
+  // gives up on the call() the thread is in
+  [[noreturn]] static void fail()
+  {
+    std::longjmp(*on_error(), 1);
+  }
+
+  void run(int main)
+  {
+    int32_t fp = enter(&program.functions[main], 0, nullptr);
+    invoke(main, fp);
+    std::fflush(stdout);
+  }
+
+  /*
+  * The entry points of the native code into the VM, for
+  * calls, library calls and runtime errors
+  */
+  static int32_t native_call(VM *vm, int32_t caller, int32_t caller_fp, int32_t callee, const int32_t *args)
+  {
+    const VMFunction *F = &vm->program.functions[callee];
+    int32_t fp = vm->enter(F, vm->static_link(&vm->program.functions[caller], caller_fp, F), args);
+    vm->count(callee);
+    int32_t value = vm->invoke(callee, fp);
+    vm->sp = fp;
+    return value;
+  }
+
+  static int32_t native_library(VM *vm, int32_t f, const int32_t *args)
+  {
+    return vm->call_library((LibraryFunction)f, args);
+  }
+
+  [[noreturn]] static void native_fault(int32_t division)
+  {
+    error(division ? "Division by zero" : "Invalid memory access");
+  }
+
+  // whether the library function only reads and writes the memory it is given
+  static bool library_is_pure(LibraryFunction f)
+  {
+    switch (f) {
+    case LibraryFunction::ascii:
+    case LibraryFunction::chr:
+    case LibraryFunction::strlen:
+    case LibraryFunction::strcmp:
+    case LibraryFunction::strcpy:
+    case LibraryFunction::strcat:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  static int library_arity(LibraryFunction f)
+  {
+    switch (f) {
+    case LibraryFunction::readInteger:
+    case LibraryFunction::readChar:
+      return 0;
+    case LibraryFunction::readString:
+    case LibraryFunction::strcmp:
+    case LibraryFunction::strcpy:
+    case LibraryFunction::strcat:
+      return 2;
+    default:
+      return 1;
+    }
+  }
+
+private:
+  const VMProgram &program;
+  std::unique_ptr<char, decltype(&std::free)> memory;
+  std::unique_ptr<int32_t, decltype(&std::free)> registers;
+  int32_t *register_top;
+  int32_t sp;
+
+  std::vector<uint32_t> heat;
+  uint32_t hot_threshold = 0;
+  std::function<void(int)> on_hot;
+  std::unique_ptr<std::atomic<NativeFunction>[]> native;
+  int32_t stack_limit = memory_size;
+
+  // the callers of the interpreted functions running, kept out of execute() so that fail() frees nothing
+  struct Frame {
+    const VMFunction *function;
+    const Instruction *pc;
+    int32_t *registers;
+    int32_t fp;
+    int32_t result;
+  };
+  std::vector<Frame> frames;
+
+  // where a runtime error goes while the thread is in call(); nowhere otherwise
+  static std::jmp_buf *&on_error()
+  {
+    static thread_local std::jmp_buf *target = nullptr;
+    return target;
+  }
+
+  void count(int index)
+  {
+    if (++heat[index] == hot_threshold && on_hot)
+      on_hot(index);
+  }
+
+  // the callee's parent is the caller, or one of the caller's ancestors
+  int32_t static_link(const VMFunction *caller, int32_t caller_fp, const VMFunction *callee) const
+  {
+    int32_t link = caller_fp;
+    for (int hops = caller->depth - callee->depth + 1; hops > 0; hops--)
+      link = load32(link);
+    return link;
+  }
+
+  // pushes the frame of a call and returns its address
+  int32_t enter(const VMFunction *F, int32_t link, const int32_t *args)
+  {
+    int32_t fp = sp;
+    if (F->frame_size > stack_limit - fp)
+      error("Stack overflow");
+    sp = fp + F->frame_size;
+    char *M = memory.get();
+    std::memset(M + fp, 0, F->frame_size);
+    std::memcpy(M + fp, &link, 4);
+    for (unsigned i = 0; i < F->params.size(); i++) {
+      if (F->params[i].size == 1) M[fp + F->params[i].offset] = args[i];
+      else std::memcpy(M + fp + F->params[i].offset, &args[i], 4);
+    }
+    return fp;
+  }
+
+  int32_t invoke(int index, int32_t fp)
+  {
+    NativeFunction f = native[index].load(std::memory_order_acquire);
+    if (f)
+      return f(this, memory.get(), fp);
+    return execute(index, fp);
+  }
+
+  /*
+  * Interprets a function whose frame is set up, until it returns.
+  * Calls of other interpreted functions stay in the same loop.
+  */
+  int32_t execute(int index, int32_t fp)
+  {
+    // native code calls back into here, on top of the frames of the interpreter
+    size_t bottom = frames.size();
+
+    char *M = memory.get();
+    const VMFunction *F = &program.functions[index];
+    int32_t *base = register_top, *R = base;
+    int32_t *end = registers.get() + register_count;
+    if (F->registers > end - R)
+      error("Stack overflow");
+    const Instruction *code = F->code.data(), *pc = code;
+
+    /*
+    * With GCC and Clang every instruction jumps straight to the next
+    * one through a table of label addresses, which predicts much
+    * better than the single indirect jump of a switch
+    */
+#if defined(__GNUC__)
+    static const void *dispatch[] = {
+      &&op_CONST, &&op_MOV, &&op_ADD, &&op_SUB, &&op_MUL, &&op_DIV, &&op_MOD, &&op_ADDI, &&op_MULI, &&op_NEG,
+      &&op_SEXT8, &&op_EQ, &&op_NE, &&op_LT, &&op_GT, &&op_LE, &&op_GE, &&op_NOT, &&op_JMP, &&op_JZ,
+      &&op_JNZ, &&op_JEQ, &&op_JNE, &&op_JLT, &&op_JGT, &&op_JLE, &&op_JGE, &&op_LOOP, &&op_FRAME,
+      &&op_ADDRUP, &&op_LOADL32, &&op_LOADL8, &&op_STOREL32, &&op_STOREL8, &&op_LOAD32, &&op_LOAD8,
+      &&op_STORE32, &&op_STORE8, &&op_CALL, &&op_LIB, &&op_RET, &&op_RETV
+    };
+    static_assert(sizeof(dispatch) / sizeof(*dispatch) == int(Op::RETV) + 1, "missing opcode");
+#define VM_CASE(name) op_##name:
+#define VM_NEXT() do { I = pc++; goto *dispatch[int(I->op)]; } while (0)
+    const Instruction *I;
+    VM_NEXT();
+#else
+#define VM_CASE(name) case Op::name:
+#define VM_NEXT() break
+    for (;;) {
+      const Instruction *I = pc++;
+      switch (I->op) {
+#endif
+      VM_CASE(CONST) R[I->a] = I->b; VM_NEXT();
+      VM_CASE(MOV) R[I->a] = R[I->b]; VM_NEXT();
+      VM_CASE(ADD) R[I->a] = (uint32_t)R[I->b] + (uint32_t)R[I->c]; VM_NEXT();
+      VM_CASE(SUB) R[I->a] = (uint32_t)R[I->b] - (uint32_t)R[I->c]; VM_NEXT();
+      VM_CASE(MUL) R[I->a] = (uint32_t)R[I->b] * (uint32_t)R[I->c]; VM_NEXT();
+      VM_CASE(DIV) R[I->a] = divide(R[I->b], R[I->c], false); VM_NEXT();
+      VM_CASE(MOD) R[I->a] = divide(R[I->b], R[I->c], true); VM_NEXT();
+      VM_CASE(ADDI) R[I->a] = (uint32_t)R[I->b] + (uint32_t)I->c; VM_NEXT();
+      VM_CASE(MULI) R[I->a] = (uint32_t)R[I->b] * (uint32_t)I->c; VM_NEXT();
+      VM_CASE(NEG) R[I->a] = 0u - (uint32_t)R[I->b]; VM_NEXT();
+      VM_CASE(SEXT8) R[I->a] = (int8_t)R[I->b]; VM_NEXT();
+      VM_CASE(EQ) R[I->a] = R[I->b] == R[I->c]; VM_NEXT();
+      VM_CASE(NE) R[I->a] = R[I->b] != R[I->c]; VM_NEXT();
+      VM_CASE(LT) R[I->a] = R[I->b] < R[I->c]; VM_NEXT();
+      VM_CASE(GT) R[I->a] = R[I->b] > R[I->c]; VM_NEXT();
+      VM_CASE(LE) R[I->a] = R[I->b] <= R[I->c]; VM_NEXT();
+      VM_CASE(GE) R[I->a] = R[I->b] >= R[I->c]; VM_NEXT();
+      VM_CASE(NOT) R[I->a] = !R[I->b]; VM_NEXT();
+      VM_CASE(JMP) pc = code + I->a; VM_NEXT();
+      VM_CASE(JZ) if (!R[I->a]) pc = code + I->b; VM_NEXT();
+      VM_CASE(JNZ) if (R[I->a]) pc = code + I->b; VM_NEXT();
+      VM_CASE(JEQ) if (R[I->a] == R[I->b]) pc = code + I->c; VM_NEXT();
+      VM_CASE(JNE) if (R[I->a] != R[I->b]) pc = code + I->c; VM_NEXT();
+      VM_CASE(JLT) if (R[I->a] < R[I->b]) pc = code + I->c; VM_NEXT();
+      VM_CASE(JGT) if (R[I->a] > R[I->b]) pc = code + I->c; VM_NEXT();
+      VM_CASE(JLE) if (R[I->a] <= R[I->b]) pc = code + I->c; VM_NEXT();
+      VM_CASE(JGE) if (R[I->a] >= R[I->b]) pc = code + I->c; VM_NEXT();
+      VM_CASE(LOOP) count(F - program.functions.data()); VM_NEXT();
+      VM_CASE(FRAME) R[I->a] = fp + I->b; VM_NEXT();
+      VM_CASE(ADDRUP) {
+        int32_t frame = fp;
+        for (int hops = I->b; hops > 0; hops--)
+          frame = load32(frame);
+        R[I->a] = frame + I->c;
+        VM_NEXT();
+      }
+      VM_CASE(LOADL32) std::memcpy(&R[I->a], M + fp + I->b, 4); VM_NEXT();
+      VM_CASE(LOADL8) R[I->a] = (int8_t)M[fp + I->b]; VM_NEXT();
+      VM_CASE(STOREL32) std::memcpy(M + fp + I->a, &R[I->b], 4); VM_NEXT();
+      VM_CASE(STOREL8) M[fp + I->a] = R[I->b]; VM_NEXT();
+      VM_CASE(LOAD32) R[I->a] = load32(R[I->b]); VM_NEXT();
+      VM_CASE(LOAD8) check(R[I->b], 1); R[I->a] = (int8_t)M[R[I->b]]; VM_NEXT();
+      VM_CASE(STORE32) check(R[I->a], 4); std::memcpy(M + R[I->a], &R[I->b], 4); VM_NEXT();
+      VM_CASE(STORE8) check(R[I->a], 1); M[R[I->a]] = R[I->b]; VM_NEXT();
+      VM_CASE(CALL) {
+        const VMFunction *callee = &program.functions[I->b];
+        int32_t callee_fp = enter(callee, static_link(F, fp, callee), R + I->c);
+        count(I->b);
+        NativeFunction f = native[I->b].load(std::memory_order_acquire);
+        if (f) {
+          register_top = R + F->registers;
+          R[I->a] = f(this, M, callee_fp);
+          sp = callee_fp;
+          VM_NEXT();
+        }
+        frames.push_back({ F, pc, R, fp, I->a });
+        R += F->registers;
+        if (callee->registers > end - R)
+          error("Stack overflow");
+        fp = callee_fp;
+        F = callee;
+        code = pc = F->code.data();
+        VM_NEXT();
+      }
+      VM_CASE(LIB) R[I->a] = call_library((LibraryFunction)I->b, R + I->c); VM_NEXT();
+      VM_CASE(RET)
+      VM_CASE(RETV) {
+        int32_t value = I->op == Op::RET ? R[I->a] : 0;
+        if (frames.size() == bottom) {
+          register_top = base;
+          return value;
+        }
+        Frame &caller = frames.back();
+        sp = fp;
+        F = caller.function;
+        code = F->code.data();
+        pc = caller.pc;
+        R = caller.registers;
+        fp = caller.fp;
+        R[caller.result] = value;
+        frames.pop_back();
+        VM_NEXT();
+      }
+#if !defined(__GNUC__)
+      }
+    }
+#endif
+#undef VM_CASE
+#undef VM_NEXT
+  }
+
+  [[noreturn]] static void error(const char *msg)
+  {
+    if (on_error() != nullptr)
+      fail();
+    std::fflush(stdout);
+    std::cerr << "Runtime error: " << msg << std::endl;
+    exit(1);
+  }
+
+  void check(int32_t address, int32_t size) const
+  {
+    if ((uint32_t)address > (uint32_t)(memory_size - size))
+      error("Invalid memory access");
+  }
+
+  int32_t load32(int32_t address) const
+  {
+    check(address, 4);
+    int32_t value;
+    std::memcpy(&value, memory.get() + address, 4);
+    return value;
+  }
+
+  char *string(int32_t address) const
+  {
+    check(address, 1);
+    return memory.get() + address;
+  }
+
+  static int32_t divide(int32_t a, int32_t b, bool remainder)
+  {
+    if (b == 0)
+      error("Division by zero");
+    if (b == -1) // INT_MIN / -1 overflows
+      return remainder ? 0 : 0u - (uint32_t)a;
+    return remainder ? a % b : a / b;
+  }
+
+  int32_t call_library(LibraryFunction f, const int32_t *args)
+  {
+    switch (f) {
+    case LibraryFunction::writeInteger: Runtime::writeInteger(args[0]); return 0;
+    case LibraryFunction::writeChar: Runtime::writeChar(args[0]); return 0;
+    case LibraryFunction::writeString: Runtime::writeString(string(args[0])); return 0;
+    case LibraryFunction::readInteger: return Runtime::readInteger();
+    case LibraryFunction::readChar: return (int8_t)Runtime::readChar();
+    case LibraryFunction::readString:
+      if (args[0] > 0) check(args[1], args[0]);
+      Runtime::readString(args[0], string(args[1])); return 0;
+    case LibraryFunction::ascii: return Runtime::ord(args[0]);
+    case LibraryFunction::chr: return (int8_t)Runtime::chr(args[0]);
+    case LibraryFunction::strlen: return Runtime::strlen(string(args[0]));
+    case LibraryFunction::strcmp: return Runtime::strcmp(string(args[0]), string(args[1]));
+    case LibraryFunction::strcpy: Runtime::strcpy(string(args[0]), string(args[1])); return 0;
+    case LibraryFunction::strcat: Runtime::strcat(string(args[0]), string(args[1])); return 0;
+    }
+    return 0;
+  }
+};
+
+#endif